@@ -8,34 +8,110 @@ Authors:
 */
 #include <stdio.h>
 #include <stdlib.h>
+#include <ctype.h>
 #include <stdarg.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <limits.h>
 #include <string.h>
 #include <errno.h>
 #include <math.h>
 #include <time.h>
 #include <locale.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
 #ifdef _WIN32
 #include <Windows.h>
+#include <io.h>
+#include <fcntl.h>
+#include <sys/locking.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#else
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
 #endif
 
 /* Constants */
-#define N_ROOMS 6
-#define N_TABLES 3
+#define DEFAULT_ROOMS 6
+#define MAX_ROOMS 4096
+#define MAX_ROOM_WORDS (MAX_ROOMS / 64)
+#define NO_ROOM 0
+#define ANY_PRICE -1
+#define MAX_TABLES 16
+#define N_BOARD_TYPES 4
 #define N_RAND_DIGITS 3
-#define N_TIMESLOTS 2
+#define MAX_TIMESLOTS 8
+#define DINING_INITIAL_DAYS 64
 #define INVALID_TABLE_ENTRY 0
 #define TABLE_UNAVAILABLE -1
-#define FILE_DOES_NOT_EXIST 2
 #define MAX_DAYS 50
 #define BOOKING_FILE "bookings.txt"
+#define FIRST_SEQUENCE 10
 #define NAME_CHARS "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ -"
+#define NO_BOOKING -1
+#define STORE_INITIAL_CAPACITY 16
+#define ARENA_BLOCK_SIZE 65536
+#define OUTPUT_BUFFER_SIZE 65536
+#define JOURNAL_BLOCK_SIZE 512
+#define JOURNAL_COMPACT_THRESHOLD 256
+#define BINARY_MAGIC "KHBK"
+#define BINARY_VERSION 5
+#define NO_STRING 0xffffffffu
+#define BATCH_RESULT_SIZE 128
+#define NO_GENERATION -1
+#define LOCK_ATTEMPTS 500
+#define LOCK_RETRY_MS 10
+#define LOCK_BUSY -1
+#define DATA_LOCK_BYTE 0
+#define WAITING_LOCK_BYTE 1
+#define BATCH_CHUNK_COMMANDS 256
+#define SERVER_THREADS 4
+#define MAX_SERVER_THREADS 64
+#define MAX_LOOP_THREADS 64
+#define MIN_CHUNK_ITEMS 4096
+#define SERVER_QUEUE_SIZE 64
+#define SERVER_LINE_SIZE 1024
+#define SERVER_BUSY "error: server busy"
+#define ID_VIEW_BUCKETS 256
+#define MAX_INVOICE_LINES 8
+#define STANDARD_MEALS -1
+#define MONEY_SIZE 24
+#define TIME_SIZE 6
+#define NO_DATE INT_MIN
+#define DAYS_PER_ERA 146097
+#define EPOCH_DAY_OFFSET 719468
 
 /* Global variables */
 
+// Board types, with the values stored in the binary format
+typedef enum {
+    NoBoard         = 0,
+    FullBoard       = 1,
+    HalfBoard       = 2,
+    BedAndBreakfast = 3
+} BoardType;
+
 // Booking structure containing information about each booking
 typedef struct {
-    char *firstName, *lastName, *dob, *id, *boardType;
+    char *firstName, *lastName, *id;
+    BoardType boardType;
+    // Date of birth as a day number
+    int dob;
     int nDays, nAdults, nChildren, paper, roomNum, tableNum, tableSlot, empty;
+    // Stay from the arrival day up to (not including) the departure day, as
+    // day numbers
+    int arrival, departure;
+    // Night of the stay that the table is booked for
+    int tableDay;
 } Booking;
 
 // The order of the fields in the data file
@@ -51,32 +127,136 @@ typedef enum {
     paper,
     roomNum,
     tableNum,
-    tableSlot
+    tableSlot,
+    arrival,
+    departure,
+    tableDay
 } BookingOrder;
 
-// Table names
-typedef enum {
-    Endor    = 1,
-    Naboo    = 2,
-    Tatooine = 3
-} Tables;
-
-// Prices for each room
-static int roomPrices[N_ROOMS] = { 100, 100, 85, 75, 75, 50 };
+// Skip the pauses between console messages (--fast or KASHYYYK_FAST=1)
+static int fastMode = 0;
+// Threads that loops over many bookings are split across: one per core, or
+// KASHYYYK_THREADS
+static int nLoopThreads = 1;
+// Dining tables, numbered from 1, and the dinner time slots (pm) that they can
+// be booked for. Set with --tables and --timeslots
+static int nTables = 3;
+static const char* tableNames[MAX_TABLES + 1] = { NULL, "Endor", "Naboo", "Tatooine" };
+static int nTimeSlots = 2;
+static int timeSlots[MAX_TIMESLOTS] = { 7, 9 };
+// Rooms, numbered from 1, and the 64-bit words a bitmap of them takes. The
+// tariff given with --tariff can change the number of rooms
+static int nRooms = DEFAULT_ROOMS;
+static int nRoomWords = (DEFAULT_ROOMS + 63) / 64;
+static int defaultRoomRates[DEFAULT_ROOMS + 1] = { 0, 10000, 10000, 8500, 7500, 7500, 5000 };
+// Prices in pence, which --tariff can replace
+typedef struct {
+    // Per night, indexed by room number
+    int* roomRates;
+    // Per person per meal for each board type, and the meals a night on each
+    // board includes, charged when the meals eaten were not counted
+    int boardRates[N_BOARD_TYPES];
+    int boardMeals[N_BOARD_TYPES];
+    // Share of the adult board rate that children pay, in percent
+    int childPercent;
+    // Per stay
+    int paperRate;
+    // Discount on the room for guests aged seniorAge or over, in percent
+    int seniorAge, seniorPercent;
+} Tariff;
+static Tariff tariff = {
+    defaultRoomRates,
+    { 0, 2000, 1500, 500 },
+    { 0, 3, 2, 1 },
+    50, 550, 65, 10
+};
+// Codes used in the text format and display names for each board type
+static const char* boardCodes[N_BOARD_TYPES] = { "", "FB", "HB", "BB" };
+static const char* boardNames[N_BOARD_TYPES] = { "", "Full-Board", "Half-Board", "Bed & Breakfast" };
+// Whether each board type includes dinner, which a table can be booked for
+static const int boardIncludesDinner[N_BOARD_TYPES] = { 0, 1, 1, 0 };
 // Days per month used to calculate difference between dates
 static int daysPerMonth[12] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+// Today as a day number, cached until the next local midnight
+static int cachedDay = NO_DATE;
+static time_t nextDayBoundary = 0;
+// Fixed day used instead of the system clock (--today or KASHYYYK_TODAY), or
+// NO_DATE
+static int pinnedDay = NO_DATE;
 
 /* Utility functions */
 
-// Removes any '\n' characters from a string
-void removeNewLine(char* s) 
+// Check whether a year is a leap year in the Gregorian calendar
+int isLeapYear(int year)
 {
-    char* d = s;
-    do {
-        while (*d == '\n') {
-            ++d;
-        }
-    } while (*s++ = *d++);
+    return year % 4 == 0 && (year % 100 != 0 || year % 400 == 0);
+}
+
+// Get the number of days in a month of a given year
+int monthLength(int month, int year)
+{
+    return (month == 2 && isLeapYear(year)) ? 29 : daysPerMonth[month - 1];
+}
+
+// Convert a calendar date into a day number (days since 01/01/1970, negative
+// before then) in constant time
+int dayNumber(int day, int month, int year)
+{
+    // Count years from March so that the leap day is the last day of the
+    // year, then split them into 400 year eras which all have the same length
+    year -= month <= 2;
+    int era = (year >= 0 ? year : year - 399) / 400;
+    int yearOfEra = year - era * 400;
+    int dayOfYear = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+    int dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+    return era * DAYS_PER_ERA + dayOfEra - EPOCH_DAY_OFFSET;
+}
+
+// Convert a day number back into a calendar date, the inverse of dayNumber()
+void dayToDate(int dayNum, int* day, int* month, int* year)
+{
+    dayNum += EPOCH_DAY_OFFSET;
+    int era = (dayNum >= 0 ? dayNum : dayNum - (DAYS_PER_ERA - 1)) / DAYS_PER_ERA;
+    int dayOfEra = dayNum - era * DAYS_PER_ERA;
+    int yearOfEra = (dayOfEra - dayOfEra / 1460 + dayOfEra / 36524 - dayOfEra / (DAYS_PER_ERA - 1)) / 365;
+    int dayOfYear = dayOfEra - (yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100);
+    int shiftedMonth = (5 * dayOfYear + 2) / 153;
+    *day = dayOfYear - (153 * shiftedMonth + 2) / 5 + 1;
+    *month = shiftedMonth < 10 ? shiftedMonth + 3 : shiftedMonth - 9;
+    *year = yearOfEra + era * 400 + (*month <= 2);
+}
+
+// Format a day number as a date string (DD/MM/YYYY), the buffer must hold
+// at least 11 characters
+void formatDay(int dayNum, char* buffer)
+{
+    int day, month, year;
+    dayToDate(dayNum, &day, &month, &year);
+    snprintf(buffer, 11, "%02d/%02d/%04d", day, month, year);
+}
+
+// Get the current date as a day number. The local date is only worked out
+// again once the clock passes midnight
+int currentDay()
+{
+    if (pinnedDay != NO_DATE) return pinnedDay;
+    time_t seconds = time(NULL);
+    if (cachedDay == NO_DATE || seconds >= nextDayBoundary) {
+        struct tm t = *localtime(&seconds);
+        cachedDay = dayNumber(t.tm_mday, t.tm_mon + 1, t.tm_year + 1900);
+        t.tm_mday++;
+        t.tm_hour = t.tm_min = t.tm_sec = 0;
+        t.tm_isdst = -1;
+        nextDayBoundary = mktime(&t);
+    }
+    return cachedDay;
+}
+
+// Pin the clock to a day number for deterministic tests and replays, or go
+// back to the system clock with NO_DATE
+void setCurrentDay(int day)
+{
+    pinnedDay = day;
 }
 
 // Trim any leading or trailing whitespace from a string
@@ -100,747 +280,4486 @@ char* trim(char *str)
     return str;
 }
 
-// Print data to the console then sleep for a period of time
+// Get the wall clock time in seconds, for timing operations that may use
+// several threads
+double wallSeconds()
+{
+    struct timespec now;
+    timespec_get(&now, TIME_UTC);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+// Pause for a number of milliseconds
+void sleepMs(int ms)
+{
+#ifdef _WIN32
+    Sleep(ms);
+#else
+    struct timespec duration = { ms / 1000, (ms % 1000) * 1000000L };
+    nanosleep(&duration, NULL);
+#endif
+}
+
+// Print data to the console then sleep for a period of time in milliseconds,
+// unless running in fast mode
 void print(int delay, const char* fmt, ...) 
 {
     va_list args;
     va_start(args, fmt);
     vprintf(fmt, args);
     va_end(args);
-#ifdef _WIN32
-    Sleep(delay);
-#else
-    sleep(delay);
-#endif
+    if (fastMode || delay <= 0) return;
+    // Show the message before pausing, even if it does not end a line
+    fflush(stdout);
+    sleepMs(delay);
 }
 
-// Maps a table enum value to a string, with optional formatting
-char* getTableName(Tables table, int pad)
+// Maps a table number to its name
+const char* getTableName(int table)
 {
-    if (table == Endor) return (pad ? "Endor   " : "Endor");
-    if (table == Naboo) return (pad ? "Naboo   " : "Naboo");
-    if (table == Tatooine) return "Tatooine";
-    return NULL;
+    if (table < 1 || table > nTables) return NULL;
+    return tableNames[table];
 }
 
-// Input validation
-// Check to see if a string contains any invalid characters
-// or make sure that it only contains valid characters
-int containsInvalidChars(char* str, const char* invalidChars, const char* validChars)
-{
-    if ((invalidChars == NULL && validChars == NULL) || (invalidChars != NULL && validChars != NULL)) return 0;
-    if (invalidChars == NULL) {
-        for (int i = 0; i < strlen(str); ++i) {
-            int validChar = 0;
-            for (int j = 0; j < strlen(validChars); ++j) {
-                if (validChars[j] == str[i]) {
-                    validChar = 1;
-                    break;
-                }
-            }
-            if (!validChar) {
-                printf("Only the following characters are allowed: %s\n", validChars);
-                return 1;
-            }
-        }
-    } else {
-        for (int i = 0; i < strlen(invalidChars); ++i) {
-            for (int j = 0; j < strlen(str); ++j) {
-                if (invalidChars[i] == str[j]) {
-                    printf("The following characters are not allowed: %s\n", invalidChars);
-                    return 1;
-                }
-            }
-        }
+// Get the length of the longest table name, for lining up lists of tables
+int tableNameWidth()
+{
+    int width = 0;
+    for (int table = 1; table <= nTables; ++table) {
+        if ((int)strlen(tableNames[table]) > width) width = strlen(tableNames[table]);
     }
-    return 0;
+    return width;
 }
 
-// Generate a pseudorandom integer inbetween to bounds (inclusive)
-int randInt(int min, int max)
+// Return the index of a time slot (pm), or -1 if tables cannot be booked then
+int timeSlotIndex(int timeSlot)
 {
-    return rand() % (max - min + 1) + min;
+    for (int i = 0; i < nTimeSlots; ++i) {
+        if (timeSlots[i] == timeSlot) return i;
+    }
+    return -1;
 }
 
-// Concatenate two strings and dynamically resize if necessary
-char* concatStr(char *s1, const char *s2)
+// Format a time slot (pm) as a 24 hour time, such as 19:00 for 7pm
+void formatTimeSlot(int timeSlot, char* buffer)
 {
-    const size_t a = strlen(s1);
-    const size_t b = strlen(s2);
-    const size_t combinedSize = a + b + 1;
+    snprintf(buffer, TIME_SIZE, "%02d:00", timeSlot % 12 + 12);
+}
 
-    s1 = realloc(s1, combinedSize);
-    if (s1 == NULL) {
-        printf("realloc() failed\n");
+// Set the dining tables from a comma separated list of names
+void configureTables(const char* list)
+{
+    char* names = malloc(strlen(list) + 1);
+    strcpy(names, list);
+    nTables = 0;
+    for (char* name = strtok(names, ","); name != NULL; name = strtok(NULL, ",")) {
+        if (nTables == MAX_TABLES) {
+            printf("error: at most %d tables are supported\n", MAX_TABLES);
+            exit(EXIT_FAILURE);
+        }
+        tableNames[++nTables] = name;
+    }
+    if (nTables == 0) {
+        printf("error: at least one table is needed\n");
         exit(EXIT_FAILURE);
     }
-    memcpy(s1 + a, s2, b + 1);
+}
 
-    return s1;
+// Set the dinner time slots from a comma separated list of hours (pm)
+void configureTimeSlots(const char* list)
+{
+    const char* cursor = list;
+    char* end;
+    nTimeSlots = 0;
+    do {
+        long hour = strtol(cursor, &end, 10);
+        if (end == cursor || (*end != ',' && *end != '\0') || hour < 1 || hour > 11
+            || nTimeSlots == MAX_TIMESLOTS || timeSlotIndex(hour) != -1) {
+            printf("error: time slots must be up to %d different hours between 1 and 11 (pm)\n", MAX_TIMESLOTS);
+            exit(EXIT_FAILURE);
+        }
+        timeSlots[nTimeSlots++] = hour;
+        cursor = end + 1;
+    } while (*end == ',');
 }
 
-// Convert an integer to string
-// NOTE: this function does not accept negative integers
-char* intToString(int n)
+// Input validation
+// Lookup table of the characters allowed in a field, so that a string can be
+// validated in one pass whatever the size of the set
+typedef struct {
+    unsigned char allowed[256];
+    const char* chars;
+} CharClass;
+
+// Character classes for the fields entered by guests
+static CharClass nameClass, digitClass;
+
+// Build the lookup table for a set of allowed characters
+void initCharClass(CharClass* charClass, const char* chars)
 {
-    if (n < 0) {
-        printf("cannot convert %d to string\n", n);
-    }
-    int nDigits = n ? ceil(log10(n)) + 1 : 1;
-    char* buffer = malloc(nDigits); // free later to avoid memory leak
-    itoa(n, buffer, 10);
-    return buffer;
+    memset(charClass->allowed, 0, sizeof(charClass->allowed));
+    for (const char* c = chars; *c != '\0'; ++c) charClass->allowed[(unsigned char)*c] = 1;
+    charClass->chars = chars;
 }
 
-// Parse the .txt/.csv file and populate an array of Booking objects
-// with the appropriate data, including handling data conversion
-int parseCSV(char* data, Booking bookings[N_ROOMS])
+// Build the character classes used for input validation
+void initCharClasses()
 {
-    char* record = strtok(data, ";");
-    int idx = 0;
-    char* records[N_ROOMS];
-    while (record != NULL) {
-        records[idx] = record;
-        record = strtok(NULL, ";");
-        idx++;
-    }
-    for (int i = 0; i < idx; ++i) {
-        Booking* booking = (bookings + i);
-        // Optional fields with default values
-        booking->tableNum = -1;
-        booking->tableSlot = -1;
-        char* record = strdup(records[i]);
-        removeNewLine(record);
-        int fieldIdx = 0;
-        char* field = strtok(record, ",");
-        while (field != NULL) {
-            if (fieldIdx == firstName) booking->firstName = field;
-            if (fieldIdx == lastName) booking->lastName = field;
-            if (fieldIdx == dob) booking->dob = field;
-            if (fieldIdx == id) booking->id = field;
-            if (fieldIdx == boardType) booking->boardType = field;
-            if (fieldIdx == nDays) booking->nDays = atoi(field);
-            if (fieldIdx == nAdults) booking->nAdults = atoi(field);
-            if (fieldIdx == nChildren) booking->nChildren = atoi(field);
-            if (fieldIdx == paper) booking->paper = atoi(field);
-            if (fieldIdx == roomNum) booking->roomNum = atoi(field);
-            if (fieldIdx == tableNum) booking->tableNum = atoi(field);
-            if (fieldIdx == tableSlot) booking->tableSlot = atoi(field);
-            field = strtok(NULL, ",");
-            fieldIdx++;
-        }
+    initCharClass(&nameClass, NAME_CHARS);
+    initCharClass(&digitClass, "0123456789");
+}
 
-    }
-    return idx;
+// Return the number of leading characters of a string that are in a class.
+// '\0' is never in a class, so the scan stops at the end of the string
+size_t spanCharClass(const CharClass* charClass, const char* str)
+{
+    const unsigned char* c = (const unsigned char*)str;
+    while (charClass->allowed[*c]) c++;
+    return c - (const unsigned char*)str;
 }
 
-// Removes a booking from the booking array, and updates the array and 
-// the booking counter variable accordingly
-void removeBooking(Booking bookings[N_ROOMS], int idx, int* nBookings)
+// Check whether a string contains characters outside of a class, printing
+// the allowed characters if it does
+int containsCharsOutside(const char* str, const CharClass* charClass)
 {
-    for (int i = idx + 1; i < *nBookings; ++i) {
-        bookings[i - 1] = bookings[i];
-    }
-    *nBookings = (*nBookings) - 1;
-    Booking emptyBooking;
-    bookings[*nBookings] = emptyBooking;
+    if (str[spanCharClass(charClass, str)] == '\0') return 0;
+    printf("Only the following characters are allowed: %s\n", charClass->chars);
+    return 1;
 }
 
-// High level function to load the booking data from a text file, returning
-// the number of bookings that were loaded successfully
-int loadBookingData(const char* filename, Booking bookings[N_ROOMS])
+// Check whether len characters have the date format DD/MM/YYYY
+int matchesDatePattern(const char* str, size_t len)
 {
-    FILE* f = fopen(filename, "r");
-    if (f == NULL) {
-        // If the file does not exist, create it
-        if (errno == FILE_DOES_NOT_EXIST) {
-            f = fopen(filename, "w");
-            if (f == NULL) {
-                print(500, "error: could not create file\n");
-                exit(EXIT_FAILURE);
-            }
-            fclose(f);
-            f = fopen(filename, "r");    
-        } else {
-            print(500, "error: fopen() failed with code: %d\n", errno);
-            exit(EXIT_FAILURE);
-        }
-    }
-    // Calculate size of the file in bytes 
-    fseek(f, 0, SEEK_END);
-    size_t fSize = ftell(f);
-    fseek(f, 0, SEEK_SET);
-    // Allocate buffer of size fSize bytes
-    char* data = malloc(fSize);
-    if (data == NULL) {
-        printf("error: malloc() failed\n");
-        exit(EXIT_FAILURE);   
-    }
-    char c = 0;
-    int bytesRead = 0;
-    while (bytesRead != fSize) {
-        c = fgetc(f);
-        data[bytesRead] = c;
-        bytesRead++;
-    }
-    data[fSize - 1] = '\0';
-    int nResults = parseCSV(data, bookings);
-    fclose(f);
-    return nResults;
-}
-
-// High level function to serialize the booking array into a string and
-// save it to a text file
-void saveBookingData(const char* filename, Booking bookings[N_ROOMS], int nBookings)
-{
-    char *buffer = malloc(10), *delim = ",", *lineBreak = ";\n";
-    *buffer = '\0';
-    int charIdx = 0;
-    for (int i = 0; i < nBookings; ++i) {
-        Booking booking = bookings[i];
-        buffer = concatStr(buffer, booking.firstName);
-        buffer = concatStr(buffer, delim);
-        buffer = concatStr(buffer, booking.lastName);
-        buffer = concatStr(buffer, delim);
-        buffer = concatStr(buffer, booking.dob);
-        buffer = concatStr(buffer, delim);
-        buffer = concatStr(buffer, booking.id);
-        buffer = concatStr(buffer, delim);
-        buffer = concatStr(buffer, booking.boardType);
-        buffer = concatStr(buffer, delim);
-        buffer = concatStr(buffer, intToString(booking.nDays));
-        buffer = concatStr(buffer, delim);
-        buffer = concatStr(buffer, intToString(booking.nAdults));
-        buffer = concatStr(buffer, delim);
-        buffer = concatStr(buffer, intToString(booking.nChildren));
-        buffer = concatStr(buffer, delim);
-        buffer = concatStr(buffer, intToString(booking.paper));
-        buffer = concatStr(buffer, delim);
-        buffer = concatStr(buffer, intToString(booking.roomNum));
-        if (booking.tableNum != INVALID_TABLE_ENTRY && booking.tableSlot != INVALID_TABLE_ENTRY 
-            && booking.tableNum != TABLE_UNAVAILABLE && booking.tableSlot != TABLE_UNAVAILABLE) {
-            buffer = concatStr(buffer, delim);
-            buffer = concatStr(buffer, intToString(booking.tableNum));
-            buffer = concatStr(buffer, delim);
-            buffer = concatStr(buffer, intToString(booking.tableSlot));
-        }
-        if ((i + 1) != nBookings) {
-            buffer = concatStr(buffer, lineBreak);
-        }
-    }
-    FILE* f = fopen(filename, "w");
-    if (f == NULL) {
-        printf("error: could not write data to disk\n");
-        exit(EXIT_FAILURE);
+    if (len != 10 || str[2] != '/' || str[5] != '/') return 0;
+    for (int i = 0; i < 10; ++i) {
+        if (i != 2 && i != 5 && !digitClass.allowed[(unsigned char)str[i]]) return 0;
     }
-    fputs(buffer, f);
-    fclose(f);
-    free(buffer);
+    return 1;
 }
 
-// Function that continously reads data from the stdin buffer until the user enters
-// a new line character, automatically resizing the buffer and returning it
-char* inputString()
+// Generate a pseudorandom integer inbetween to bounds (inclusive)
+int randInt(int min, int max)
 {
-    fflush(stdin);
-    int size = 16, ch = 0;
-    size_t len = 0;
-    char* str = realloc(NULL, sizeof(char) * size);
-    if (!str) {
-        printf("error: realloc() failed");
-        exit(EXIT_FAILURE);
-    }
-    while ((ch = fgetc(stdin)) != EOF && ch != '\n'){
-        str[len++] = ch;
-        if(len == size){
-            str = realloc(str, sizeof(char) * (size += 16));
-            if (!str) return str;
-        }
-    }
-    str[len++] = '\0';
-    return realloc(str, sizeof(char) * len);
+    return rand() % (max - min + 1) + min;
 }
 
-// Parse a datetime string (DD/MM/YYYY) into integer components for the day, month and year
-void parseDateTimeString(const char* str, int* birthDay, int* birthMonth, int* birthYear)
+/* Parallel loops */
+
+// One contiguous share of a loop run by parallelFor
+typedef struct {
+    void (*work)(void* context, int chunk, int begin, int end);
+    void* context;
+    int chunk, begin, end;
+} LoopChunk;
+
+// Get the number of cores, or 1 if it cannot be found
+int countCores()
 {
-    // Parse string passed in
-    char birthDayString[3], birthMonthString[3], birthYearString[5];
-    strncpy(birthDayString, str, 2);
-    birthDayString[2] = '\0';
-    strncpy(birthMonthString, str + 3, 2);
-    birthMonthString[2] = '\0';
-    strncpy(birthYearString, str + 6, 4);
-    birthYearString[4] = '\0';
-    *birthDay = atoi(birthDayString);
-    *birthMonth = atoi(birthMonthString);
-    *birthYear = atoi(birthYearString);
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors > 0 ? (int)info.dwNumberOfProcessors : 1;
+#else
+    long nCores = sysconf(_SC_NPROCESSORS_ONLN);
+    return nCores > 0 ? (int)nCores : 1;
+#endif
 }
 
-// Get the current date as a string (DD/MM/YYYY)
-char* currentDate()
+// Get the number of chunks to split a loop over n items into: one per loop
+// thread, unless the loop is too small to be worth starting threads for
+int loopChunks(int n)
 {
-    time_t seconds = time(NULL);
-    const struct tm* t = localtime(&seconds);
-    char* buffer = malloc(11);     
-    strftime(buffer, 11, "%d/%m/%Y", t);
-    return buffer;
+    int nChunks = n / MIN_CHUNK_ITEMS;
+    if (nChunks > nLoopThreads) nChunks = nLoopThreads;
+    return nChunks > 1 ? nChunks : 1;
 }
 
-// Calculate the number of days elapsed between two datetime strings
-int daysElapsed(char* startDate, char* endDate)
+#ifdef _WIN32
+DWORD WINAPI runLoopChunk(LPVOID arg)
+#else
+void* runLoopChunk(void* arg)
+#endif
 {
-    int d1, d2, m1, m2, y1, y2, days = 0;
-    parseDateTimeString((const char*)startDate, &d1, &m1, &y1);
-    parseDateTimeString((const char*)endDate, &d2, &m2, &y2);
-    int doy1 = d1, doy2 = d2;
-    for (int i = 0; i < m1 - 1; ++i) doy1 += ((i == 2 && y1 % 4 == 0) ? 29 : daysPerMonth[i]);
-    int drem1 = y1 % 4 == 0 ? 366 - doy1 : 365 - doy1;
-    for (int i = 0; i < m2 - 1; ++i) doy2 += ((i == 2 && y2 % 4 == 0) ? 29 : daysPerMonth[i]);
-    if (y1 == y2) return doy2 - doy1;
-    days = days + drem1 + doy2;
-    if (y1 < y2) {
-        for (int year = y1; year < y2 - 1; ++year) {
-            days += (year % 4 == 0) ? 366 : 365;
-        }
-    } else {
-        for (int year = y2; year < y1 + 1; ++year) {
-            days -= (year % 4 == 0) ? 366 : 365;
-        }
-    }
-    return days;
+    LoopChunk* chunk = arg;
+    chunk->work(chunk->context, chunk->chunk, chunk->begin, chunk->end);
+    return 0;
 }
 
-// Validate that the user has inputted a valid date of birth
-int validDOB(char* str)
+// Run work over the items [0, n) split into nChunks contiguous chunks, each on
+// its own thread, and wait for them all. The work is passed the index of its
+// chunk, so that it can total into its own slot and leave the caller to merge
+// the slots in order. A chunk whose thread cannot be started runs on the
+// calling thread instead
+void parallelFor(int n, int nChunks, void (*work)(void*, int, int, int), void* context)
 {
-    if (strlen(str) != 10) {
-        return 0;
+    LoopChunk chunks[MAX_LOOP_THREADS];
+#ifdef _WIN32
+    HANDLE threads[MAX_LOOP_THREADS];
+#else
+    pthread_t threads[MAX_LOOP_THREADS];
+#endif
+    int started[MAX_LOOP_THREADS];
+    for (int i = 0; i < nChunks; ++i) {
+        chunks[i].work = work;
+        chunks[i].context = context;
+        chunks[i].chunk = i;
+        chunks[i].begin = (int)((int64_t)n * i / nChunks);
+        chunks[i].end = (int)((int64_t)n * (i + 1) / nChunks);
+        // The calling thread takes the first chunk itself
+#ifdef _WIN32
+        threads[i] = i > 0 ? CreateThread(NULL, 0, runLoopChunk, chunks + i, 0, NULL) : NULL;
+        started[i] = threads[i] != NULL;
+#else
+        started[i] = i > 0 && pthread_create(threads + i, NULL, runLoopChunk, chunks + i) == 0;
+#endif
+        if (i > 0 && !started[i]) runLoopChunk(chunks + i);
     }
-    for (int i = 0; i < 10; ++i) {
-        if (i == 2 || i == 5) {
-            if (str[i] != '/') return 0;
-        } else {
-            if (!isdigit(str[i])) return 0;
-        }
-    } 
-    float age = daysElapsed(str, currentDate()) / 365.25f;
-    if (age < 0) {
-        printf("Invalid age!\n");
-        return 0;
-    } else if (age < 18) {
-        printf("You must be over 18 to book a room.\n");
-        return 0;
+    runLoopChunk(chunks);
+    for (int i = 1; i < nChunks; ++i) {
+        if (!started[i]) continue;
+#ifdef _WIN32
+        WaitForSingleObject(threads[i], INFINITE);
+        CloseHandle(threads[i]);
+#else
+        pthread_join(threads[i], NULL);
+#endif
     }
+}
 
-    // Parse string passed in
-    int birthDay, birthMonth, birthYear;
-    parseDateTimeString(str, &birthDay, &birthMonth, &birthYear);
+/* Room bitmaps */
 
-    if (birthYear < 1900) {
-        printf("Invalid date!\n");
-        return 0;
+// Rooms sharing a price (in pence), as a bitmap where bit r-1 stands for
+// room r, so that price filters are whole-word operations
+typedef struct {
+    int price;
+    uint64_t* rooms;
+} PriceBand;
+
+static PriceBand* priceBands = NULL;
+static int nPriceBands = 0;
+
+// Number of set bits in a word
+int countBits(uint64_t word)
+{
+#if defined(__GNUC__)
+    return __builtin_popcountll(word);
+#elif defined(_MSC_VER) && defined(_WIN64)
+    return (int)__popcnt64(word);
+#else
+    int count = 0;
+    for (; word; word &= word - 1) count++;
+    return count;
+#endif
+}
+
+// Index of the lowest set bit in a non-zero word
+int lowestBit(uint64_t word)
+{
+#if defined(__GNUC__)
+    return __builtin_ctzll(word);
+#elif defined(_MSC_VER) && defined(_WIN64)
+    unsigned long idx;
+    _BitScanForward64(&idx, word);
+    return (int)idx;
+#else
+    int idx = 0;
+    while (!(word & 1)) {
+        word >>= 1;
+        idx++;
+    }
+    return idx;
+#endif
+}
+
+// Group the rooms into one band per distinct price
+void initPriceBands()
+{
+    if (nPriceBands > 0) return;
+    priceBands = calloc(nRooms, sizeof(PriceBand));
+    if (priceBands == NULL) {
+        printf("error: out of memory\n");
+        exit(EXIT_FAILURE);
     }
-    // Day is within the month
-    if (daysPerMonth[birthMonth - 1] < birthDay || birthDay < 1) {
-        // Edge case to allow leap years
-        int leapYear = birthYear % 4 == 0;
-        if (leapYear && birthMonth == 2) {
-            if (birthDay < 1 || birthDay > 29) {
-                printf("Day must be between 1 and 29!\n");
-                return 0;
+    for (int room = 1; room <= nRooms; ++room) {
+        int band = 0;
+        while (band < nPriceBands && priceBands[band].price != tariff.roomRates[room]) band++;
+        if (band == nPriceBands) {
+            priceBands[band].price = tariff.roomRates[room];
+            priceBands[band].rooms = calloc(nRoomWords, sizeof(uint64_t));
+            if (priceBands[band].rooms == NULL) {
+                printf("error: out of memory\n");
+                exit(EXIT_FAILURE);
             }
-        } else {
-            printf("Day must be between 1 and %d!\n", daysPerMonth[birthMonth - 1]);
-            return 0;
+            nPriceBands++;
         }
+        priceBands[band].rooms[(room - 1) / 64] |= 1ull << ((room - 1) % 64);
     }
-    // Month is between 1 and 12
-    if (birthMonth > 12 || birthMonth < 1) {
-        printf("Month must be between 1 and 12!\n");
-        return 0;
-    }
-    return 1;
 }
-// Check in function (Orin)
-void checkIn()
-{
-    int room1Available = 1;
-    int room2Available = 1;
-    int room3Available = 1;
-    int room4Available = 1;
-    int room5Available = 1;
-    int room6Available = 1;
 
-    Booking bookings[N_ROOMS];
-    Booking booking;
-
-    int nBookings = loadBookingData("bookings.txt", bookings);
-    if (nBookings == N_ROOMS)
-    {
-        printf("Sorry the hotel is full");
-        return;
-    }
-    for (int i = 0; i < nBookings; ++i) {
-        if (bookings[i].roomNum == 1) room1Available = 0;
-        if (bookings[i].roomNum == 2) room2Available = 0;
-        if (bookings[i].roomNum == 3) room3Available = 0;
-        if (bookings[i].roomNum == 4) room4Available = 0;
-        if (bookings[i].roomNum == 5) room5Available = 0;
-        if (bookings[i].roomNum == 6) room6Available = 0;
+// Return the lowest room in a room bitmap after the given room, or NO_ROOM
+int nextRoom(const uint64_t rooms[MAX_ROOM_WORDS], int after)
+{
+    int word = after / 64;
+    if (word >= nRoomWords) return NO_ROOM;
+    // Ignore the bits for rooms up to and including the one given
+    uint64_t bits = rooms[word] & (after % 64 ? ~0ull << (after % 64) : ~0ull);
+    while (!bits) {
+        if (++word == nRoomWords) return NO_ROOM;
+        bits = rooms[word];
     }
-    printf("Please enter your first name: ");
-    booking.firstName = inputString();
+    return word * 64 + lowestBit(bits) + 1;
+}
 
-    printf("Please enter you last name: ");
-    booking.lastName = inputString();
+// Count the rooms in a room bitmap
+int countRooms(const uint64_t rooms[MAX_ROOM_WORDS])
+{
+    int count = 0;
+    for (int i = 0; i < nRoomWords; ++i) count += countBits(rooms[i]);
+    return count;
+}
 
-    printf("\n");
-    booking.dob = "00/00/0000";
-    do {
-        printf("Please enter your date of birth (DD/MM/YYYY): ");
-        booking.dob = trim(inputString());
-    } while (!validDOB(booking.dob));
+// Build the bitmap of rooms costing at most maxPrice pounds per night, or of
+// every room for ANY_PRICE
+void roomsWithin(int maxPrice, uint64_t rooms[MAX_ROOM_WORDS])
+{
+    memset(rooms, 0, sizeof(uint64_t) * nRoomWords);
+    for (int band = 0; band < nPriceBands; ++band) {
+        if (maxPrice != ANY_PRICE && priceBands[band].price > (int64_t)maxPrice * 100) continue;
+        for (int i = 0; i < nRoomWords; ++i) rooms[i] |= priceBands[band].rooms[i];
+    }
+}
 
-    int idSize = strlen(booking.lastName) + 2, idExists = 0;    
-    do {
-        idExists = 0;
-        booking.id = realloc(booking.id, idSize);
-        sprintf(booking.id, "%s%d", booking.lastName, rand() % 10);
-        for (int i = 0; i < nBookings; ++i) {
-            if (strcmp(booking.id, bookings[i].id) == 0) {
-                idExists = 1;
-            }
-        }
-    } while (idExists);
-    printf("\nHere is your booking id: %s\n", booking.id);
+/* String arena */
 
-    printf("\nAvailable board types:\n--------------------\n");
-    wprintf(L"1: Full-Board (FB)      | £20 per person, per day\n");
-    wprintf(L"2: Half-Board (HB)      | £15 per person, per day\n");
-    wprintf(L"3: Bed & Breakfast (BB) | £5  per person, per day\n");
-    int choice = 0;
-    do {
-        printf("Select a board type (1-3): ");
-        scanf("%d", &choice);
-        fflush(stdin);
-    } while (choice > 3 || choice < 1);
-    if (choice == 1) booking.boardType = "FB";
-    else if (choice == 2) booking.boardType = "HB";
-    else if (choice == 3) booking.boardType = "BB";
-    printf("\n");
+// A block of memory that strings are carved out of in order
+typedef struct ArenaBlock {
+    struct ArenaBlock* next;
+    size_t size, used;
+    char data[];
+} ArenaBlock;
 
-    printf("How many days are you staying for? ");
-    scanf("%d", &booking.nDays);
-    fflush(stdin);
-    printf("__________________________\n");
+// Bump allocator for the strings belonging to one load of the booking data.
+// Individual strings are never freed; the whole arena is released at once
+typedef struct {
+    ArenaBlock* blocks;
+} Arena;
 
-    while((booking.nAdults + booking.nChildren) > 4 || (booking.nAdults + booking.nChildren) == 0)
-    {
-        printf("How many adults are staying? ");
-        scanf("%d", &booking.nAdults);
-        fflush(stdin);
+// Initialise an empty arena
+void initArena(Arena* arena)
+{
+    arena->blocks = NULL;
+}
 
+// Allocate size bytes from an arena, starting a new block when the current
+// one is full. Requests larger than a block get a block of their own
+char* arenaAlloc(Arena* arena, size_t size)
+{
+    ArenaBlock* block = arena->blocks;
+    if (block == NULL || block->size - block->used < size) {
+        size_t blockSize = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+        block = malloc(sizeof(ArenaBlock) + blockSize);
+        if (block == NULL) {
+            printf("error: malloc() failed\n");
+            exit(EXIT_FAILURE);
+        }
+        block->size = blockSize;
+        block->used = 0;
+        block->next = arena->blocks;
+        arena->blocks = block;
+    }
+    char* ptr = block->data + block->used;
+    block->used += size;
+    return ptr;
+}
 
-        printf("How many children are staying? (age 16 or below): ");
-        scanf("%d", &booking.nChildren);
-        fflush(stdin);
-        if((booking.nChildren + booking.nAdults) > 4)
-        {
-            printf("Sorry that is too many people in one room\n__________________________\n");
+// Copy len characters of a string into an arena as a NUL-terminated string
+char* arenaString(Arena* arena, const char* str, size_t len)
+{
+    char* copy = arenaAlloc(arena, len + 1);
+    memcpy(copy, str, len);
+    copy[len] = '\0';
+    return copy;
+}
 
+// Copy a NUL-terminated string into an arena, leaving NULL as it is
+char* arenaCopy(Arena* arena, const char* str)
+{
+    return str != NULL ? arenaString(arena, str, strlen(str)) : NULL;
+}
 
-        }
+// Release every block of an arena
+void freeArena(Arena* arena)
+{
+    while (arena->blocks != NULL) {
+        ArenaBlock* next = arena->blocks->next;
+        free(arena->blocks);
+        arena->blocks = next;
     }
+}
 
-    printf("__________________________\n");
+// Strings that an interactive action keeps while its form is filled in and
+// committed. They cannot live in the store's arena, which is released when the
+// store reloads after another process compacts the booking data
+static Arena deskStrings;
 
-    do {
-        printf("Would you like a daily newspaper? (1 for yes or 0 for no): ");
-        scanf("%d", &booking.paper);
-    } while (booking.paper != 1 && booking.paper != 0);
-    printf("__________________________\n");
+/* Booking store */
 
-    int selectedRoom = 0;
-    int roomChoice = 0;
-    while (!selectedRoom) 
-    {
-        printf("Rooms available:\n---------------\n");
-        if (room1Available) wprintf(L"Room 1: £100\n");
-        if (room2Available) wprintf(L"Room 2: £100\n");
-        if (room3Available) wprintf(L"Room 3: £85\n");
-        if (room4Available) wprintf(L"Room 4: £75\n");
-        if (room5Available) wprintf(L"Room 5: £75\n");
-        if (room6Available) wprintf(L"Room 6: £50\n");
-        
-        selectedRoom = 1;
-        printf("What room would you like 1-6: \n");
-        scanf("%d", &roomChoice);
-        fflush(stdin);
+// A booking's hold on a room from its arrival day up to its departure day
+typedef struct {
+    int arrival, departure, slot;
+} Stay;
 
+// A room's stays, which never overlap, sorted by arrival. Departures are then
+// sorted too, so availability for a date range is a binary search
+typedef struct {
+    Stay* stays;
+    int nStays, capacity;
+} RoomCalendar;
 
-        while(roomChoice < 1 || roomChoice > 6)
-        {
-            printf("Please enter a valid room number...\n");
-            scanf("%d", &roomChoice);
-            fflush(stdin);
-        }
+// Dinner reservations for the days [firstDay, firstDay + nDays). Each day has
+// a row of cells, one per time slot and table, set while the table is taken
+typedef struct {
+    unsigned char* cells;
+    int firstDay, nDays;
+} DiningGrid;
 
-        if(roomChoice == 1 && room1Available == 1)
-        {
-            room1Available = 0;
-            printf("You have booked room 1\n__________________________\n");
-        }
+// Bookings stored as one dense array per field, indexed by slot, so that a
+// scan over a few fields only pulls those fields into the cache. The strings
+// themselves live in the mapped booking data or the store's arena
+typedef struct {
+    char **firstName, **lastName, **id;
+    int *dob, *arrival, *departure, *tableDay;
+    int *nDays, *nAdults, *nChildren, *paper, *roomNum, *tableNum, *tableSlot;
+    unsigned char* boardType;
+} BookingColumns;
 
-        else if(roomChoice == 2 && room2Available == 1)
-        {
-            room2Available = 0;
-            printf("You have booked room 2\n__________________________\n");
-        }
+// Growable container of bookings, indexed by booking id and by room number
+// so that lookups do not have to scan every booking
+typedef struct {
+    BookingColumns columns;
+    int nBookings, capacity;
+    // Open addressing hash table (linear probing) mapping booking ids to slots
+    int* idIndex;
+    int idIndexSize;
+    // Maps a room number to the slot of the booking occupying it
+    int* roomIndex;
+    int roomIndexSize;
+    // Bit r-1 is set while room r is occupied today
+    uint64_t* occupiedRooms;
+    // Reservations for each room, indexed by room number
+    RoomCalendar* calendars;
+    DiningGrid dining;
+    int today;
+    // Strings that do not live in the mappings below: new bookings' names
+    // and ids, and fields that could not be terminated in place
+    Arena strings;
+    // Copy-on-write mappings of the booking file and its journal, which the
+    // loaded strings point into
+    char* mappedData;
+    size_t mappedSize;
+    char* journalData;
+    size_t journalSize;
+    // Append-only log of the mutations made since the file was last compacted
+    const char* filename;
+    FILE* journal;
+    int nJournalEntries;
+    // Whether journal records are left for the caller to sync in one go
+    int deferSync;
+    // Whether the booking file uses the binary format rather than text
+    int binary;
+    // Lock file shared by every process using the booking file. It holds the
+    // generation of the booking file, which each compaction moves on
+    FILE* stamp;
+    long generation;
+    int lockDepth;
+    // Size of the journal once the records this store has seen were applied
+    long journalApplied;
+    // Buffer that the journal records appended by other processes are read
+    // into, reused by each catch-up
+    char* catchUpData;
+    size_t catchUpCapacity;
+    // Legacy bookings without stay dates that were dated when loaded, and
+    // must be saved so that their stay does not move with each load
+    int nDatedOnLoad;
+    // History of the bills of the guests that checked out, opened when the
+    // first bill is added. Nothing is ever removed from it
+    FILE* bills;
+    // Whether the store was loaded without the lock, only to be read: it
+    // never opens the journal or compacts the booking data
+    int readOnly;
+} BookingStore;
+
+// Resize a heap buffer, exiting if the allocation fails
+void* resizeBuffer(void* ptr, size_t size)
+{
+    ptr = realloc(ptr, size);
+    if (ptr == NULL) {
+        printf("error: realloc() failed\n");
+        exit(EXIT_FAILURE);
+    }
+    return ptr;
+}
+
+// Resize every column of a booking table to hold capacity bookings
+void resizeColumns(BookingColumns* columns, int capacity)
+{
+    columns->firstName = resizeBuffer(columns->firstName, sizeof(char*) * capacity);
+    columns->lastName = resizeBuffer(columns->lastName, sizeof(char*) * capacity);
+    columns->id = resizeBuffer(columns->id, sizeof(char*) * capacity);
+    columns->dob = resizeBuffer(columns->dob, sizeof(int) * capacity);
+    columns->arrival = resizeBuffer(columns->arrival, sizeof(int) * capacity);
+    columns->departure = resizeBuffer(columns->departure, sizeof(int) * capacity);
+    columns->tableDay = resizeBuffer(columns->tableDay, sizeof(int) * capacity);
+    columns->nDays = resizeBuffer(columns->nDays, sizeof(int) * capacity);
+    columns->nAdults = resizeBuffer(columns->nAdults, sizeof(int) * capacity);
+    columns->nChildren = resizeBuffer(columns->nChildren, sizeof(int) * capacity);
+    columns->paper = resizeBuffer(columns->paper, sizeof(int) * capacity);
+    columns->roomNum = resizeBuffer(columns->roomNum, sizeof(int) * capacity);
+    columns->tableNum = resizeBuffer(columns->tableNum, sizeof(int) * capacity);
+    columns->tableSlot = resizeBuffer(columns->tableSlot, sizeof(int) * capacity);
+    columns->boardType = resizeBuffer(columns->boardType, sizeof(unsigned char) * capacity);
+}
+
+// Release every column of a booking table
+void freeColumns(BookingColumns* columns)
+{
+    free(columns->firstName);
+    free(columns->lastName);
+    free(columns->id);
+    free(columns->dob);
+    free(columns->arrival);
+    free(columns->departure);
+    free(columns->tableDay);
+    free(columns->nDays);
+    free(columns->nAdults);
+    free(columns->nChildren);
+    free(columns->paper);
+    free(columns->roomNum);
+    free(columns->tableNum);
+    free(columns->tableSlot);
+    free(columns->boardType);
+    memset(columns, 0, sizeof(BookingColumns));
+}
+
+// Gather the booking in a slot into a Booking record
+void getBooking(const BookingStore* store, int slot, Booking* booking)
+{
+    const BookingColumns* columns = &store->columns;
+    memset(booking, 0, sizeof(Booking));
+    booking->firstName = columns->firstName[slot];
+    booking->lastName = columns->lastName[slot];
+    booking->id = columns->id[slot];
+    booking->boardType = columns->boardType[slot];
+    booking->dob = columns->dob[slot];
+    booking->nDays = columns->nDays[slot];
+    booking->nAdults = columns->nAdults[slot];
+    booking->nChildren = columns->nChildren[slot];
+    booking->paper = columns->paper[slot];
+    booking->roomNum = columns->roomNum[slot];
+    booking->tableNum = columns->tableNum[slot];
+    booking->tableSlot = columns->tableSlot[slot];
+    booking->arrival = columns->arrival[slot];
+    booking->departure = columns->departure[slot];
+    booking->tableDay = columns->tableDay[slot];
+}
+
+// Scatter a Booking record into the columns of a slot
+void setBooking(BookingStore* store, int slot, const Booking* booking)
+{
+    BookingColumns* columns = &store->columns;
+    columns->firstName[slot] = booking->firstName;
+    columns->lastName[slot] = booking->lastName;
+    columns->id[slot] = booking->id;
+    columns->boardType[slot] = (unsigned char)booking->boardType;
+    columns->dob[slot] = booking->dob;
+    columns->nDays[slot] = booking->nDays;
+    columns->nAdults[slot] = booking->nAdults;
+    columns->nChildren[slot] = booking->nChildren;
+    columns->paper[slot] = booking->paper;
+    columns->roomNum[slot] = booking->roomNum;
+    columns->tableNum[slot] = booking->tableNum;
+    columns->tableSlot[slot] = booking->tableSlot;
+    columns->arrival[slot] = booking->arrival;
+    columns->departure[slot] = booking->departure;
+    columns->tableDay[slot] = booking->tableDay;
+}
+
+// FNV-1a hash of a booking id
+unsigned int hashId(const char* str)
+{
+    unsigned int hash = 2166136261u;
+    while (*str) {
+        hash ^= (unsigned char)*str++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// Initialise an empty booking store
+void initBookingStore(BookingStore* store)
+{
+    store->nBookings = 0;
+    store->capacity = STORE_INITIAL_CAPACITY;
+    memset(&store->columns, 0, sizeof(store->columns));
+    resizeColumns(&store->columns, store->capacity);
+    store->idIndexSize = STORE_INITIAL_CAPACITY * 2;
+    store->idIndex = resizeBuffer(NULL, sizeof(int) * store->idIndexSize);
+    memset(store->idIndex, 0xff, sizeof(int) * store->idIndexSize);
+    store->roomIndexSize = nRooms + 1;
+    store->roomIndex = resizeBuffer(NULL, sizeof(int) * store->roomIndexSize);
+    memset(store->roomIndex, 0xff, sizeof(int) * store->roomIndexSize);
+    store->occupiedRooms = calloc(nRoomWords, sizeof(uint64_t));
+    store->calendars = calloc(nRooms + 1, sizeof(RoomCalendar));
+    if (store->occupiedRooms == NULL || store->calendars == NULL) {
+        printf("error: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    memset(&store->dining, 0, sizeof(store->dining));
+    store->today = currentDay();
+    initPriceBands();
+    initArena(&store->strings);
+    store->mappedData = store->journalData = NULL;
+    store->mappedSize = store->journalSize = 0;
+    store->filename = NULL;
+    store->journal = NULL;
+    store->nJournalEntries = 0;
+    store->deferSync = 0;
+    store->binary = 0;
+    store->stamp = NULL;
+    store->generation = NO_GENERATION;
+    store->lockDepth = 0;
+    store->journalApplied = 0;
+    store->nDatedOnLoad = 0;
+    store->catchUpData = NULL;
+    store->catchUpCapacity = 0;
+    store->bills = NULL;
+    store->readOnly = 0;
+}
+
+void unmapFile(char* data, size_t size);
+
+// Release the arrays and file mapping owned by a booking store
+void freeBookingStore(BookingStore* store)
+{
+    freeColumns(&store->columns);
+    free(store->idIndex);
+    free(store->roomIndex);
+    if (store->calendars != NULL) {
+        for (int room = 0; room <= nRooms; ++room) free(store->calendars[room].stays);
+    }
+    free(store->calendars);
+    free(store->occupiedRooms);
+    store->calendars = NULL;
+    store->occupiedRooms = NULL;
+    free(store->dining.cells);
+    memset(&store->dining, 0, sizeof(store->dining));
+    freeArena(&store->strings);
+    free(store->catchUpData);
+    store->catchUpData = NULL;
+    store->catchUpCapacity = 0;
+    unmapFile(store->mappedData, store->mappedSize);
+    unmapFile(store->journalData, store->journalSize);
+    if (store->journal != NULL) fclose(store->journal);
+    if (store->stamp != NULL) fclose(store->stamp);
+    if (store->bills != NULL) fclose(store->bills);
+    store->stamp = NULL;
+    store->bills = NULL;
+    store->mappedData = store->journalData = NULL;
+    store->mappedSize = store->journalSize = 0;
+    store->journal = NULL;
+    store->idIndex = store->roomIndex = NULL;
+    store->nBookings = store->capacity = store->idIndexSize = store->roomIndexSize = 0;
+}
+
+// Insert a booking id into the hash index without checking the load factor
+void insertIdIndex(BookingStore* store, const char* id, int slot)
+{
+    unsigned int mask = store->idIndexSize - 1;
+    unsigned int pos = hashId(id) & mask;
+    while (store->idIndex[pos] != NO_BOOKING) {
+        pos = (pos + 1) & mask;
+    }
+    store->idIndex[pos] = slot;
+}
+
+// Return the position in the hash index holding the given slot, or -1
+int findIdIndexPos(const BookingStore* store, const char* id, int slot)
+{
+    unsigned int mask = store->idIndexSize - 1;
+    unsigned int pos = hashId(id) & mask;
+    while (store->idIndex[pos] != NO_BOOKING) {
+        if (store->idIndex[pos] == slot) return pos;
+        pos = (pos + 1) & mask;
+    }
+    return -1;
+}
+
+// Remove an entry from the hash index, shifting later entries of the probe
+// chain back so that lookups never need tombstones
+void removeIdIndex(BookingStore* store, int pos)
+{
+    unsigned int mask = store->idIndexSize - 1;
+    unsigned int hole = pos, next = (pos + 1) & mask;
+    while (store->idIndex[next] != NO_BOOKING) {
+        int slot = store->idIndex[next];
+        unsigned int home = hashId(store->columns.id[slot]) & mask;
+        // Move the entry into the hole unless its home lies cyclically in (hole, next]
+        if (((next - home) & mask) >= ((next - hole) & mask)) {
+            store->idIndex[hole] = slot;
+            hole = next;
+        }
+        next = (next + 1) & mask;
+    }
+    store->idIndex[hole] = NO_BOOKING;
+}
+
+// Return the slot of the booking with the given id, or NO_BOOKING
+int findBookingById(const BookingStore* store, const char* id)
+{
+    unsigned int mask = store->idIndexSize - 1;
+    unsigned int pos = hashId(id) & mask;
+    while (store->idIndex[pos] != NO_BOOKING) {
+        int slot = store->idIndex[pos];
+        if (strcmp(store->columns.id[slot], id) == 0) return slot;
+        pos = (pos + 1) & mask;
+    }
+    return NO_BOOKING;
+}
+
+// Return the slot of the booking occupying a room, or NO_BOOKING
+int findBookingByRoom(const BookingStore* store, int roomNum)
+{
+    if (roomNum < 1 || roomNum >= store->roomIndexSize) return NO_BOOKING;
+    return store->roomIndex[roomNum];
+}
+
+// Return the position of the first stay in a calendar that departs after the
+// given day, or the number of stays if there is none
+int findStay(const RoomCalendar* calendar, int day)
+{
+    int low = 0, high = calendar->nStays;
+    while (low < high) {
+        int mid = (low + high) / 2;
+        if (calendar->stays[mid].departure > day) {
+            high = mid;
+        } else {
+            low = mid + 1;
+        }
+    }
+    return low;
+}
+
+// Check whether a calendar has no stays overlapping [arrival, departure)
+int calendarFreeBetween(const RoomCalendar* calendar, int arrival, int departure)
+{
+    int pos = findStay(calendar, arrival);
+    return pos == calendar->nStays || calendar->stays[pos].arrival >= departure;
+}
+
+// Check whether a room has no stays overlapping [arrival, departure)
+int roomFreeBetween(const BookingStore* store, int roomNum, int arrival, int departure)
+{
+    if (roomNum < 1 || roomNum > nRooms) return 0;
+    return calendarFreeBetween(store->calendars + roomNum, arrival, departure);
+}
+
+// Insert a booking's stay into its room's calendar
+void addStay(BookingStore* store, const Booking* booking, int slot)
+{
+    if (booking->roomNum < 1 || booking->roomNum > nRooms) return;
+    RoomCalendar* calendar = store->calendars + booking->roomNum;
+    if (calendar->nStays == calendar->capacity) {
+        calendar->capacity = calendar->capacity ? calendar->capacity * 2 : 4;
+        calendar->stays = resizeBuffer(calendar->stays, sizeof(Stay) * calendar->capacity);
+    }
+    int pos = findStay(calendar, booking->arrival);
+    memmove(calendar->stays + pos + 1, calendar->stays + pos, sizeof(Stay) * (calendar->nStays - pos));
+    calendar->stays[pos].arrival = booking->arrival;
+    calendar->stays[pos].departure = booking->departure;
+    calendar->stays[pos].slot = slot;
+    calendar->nStays++;
+}
+
+// Return the calendar entry of the booking in a slot, or NULL
+Stay* findBookingStay(BookingStore* store, const Booking* booking, int slot)
+{
+    if (booking->roomNum < 1 || booking->roomNum > nRooms) return NULL;
+    RoomCalendar* calendar = store->calendars + booking->roomNum;
+    for (int pos = findStay(calendar, booking->arrival); pos < calendar->nStays; ++pos) {
+        if (calendar->stays[pos].slot == slot) return calendar->stays + pos;
+        if (calendar->stays[pos].arrival > booking->arrival) break;
+    }
+    return NULL;
+}
+
+// Remove a booking's stay from its room's calendar
+void removeStay(BookingStore* store, const Booking* booking, int slot)
+{
+    Stay* stay = findBookingStay(store, booking, slot);
+    if (stay == NULL) return;
+    RoomCalendar* calendar = store->calendars + booking->roomNum;
+    int pos = stay - calendar->stays;
+    memmove(calendar->stays + pos, calendar->stays + pos + 1, sizeof(Stay) * (calendar->nStays - pos - 1));
+    calendar->nStays--;
+}
+
+// Mark a room as occupied or free in the occupancy bitmap
+void markRoom(BookingStore* store, int roomNum, int occupied)
+{
+    if (roomNum < 1 || roomNum > nRooms) return;
+    uint64_t bit = 1ull << ((roomNum - 1) % 64);
+    if (occupied) {
+        store->occupiedRooms[(roomNum - 1) / 64] |= bit;
+    } else {
+        store->occupiedRooms[(roomNum - 1) / 64] &= ~bit;
+    }
+}
+
+// Move the store on to the current day if the date has changed, rebuilding
+// the room index and occupancy bitmap from the calendars
+void refreshOccupancy(BookingStore* store)
+{
+    int today = currentDay();
+    if (today == store->today) return;
+    store->today = today;
+    memset(store->roomIndex, 0xff, sizeof(int) * store->roomIndexSize);
+    memset(store->occupiedRooms, 0, sizeof(uint64_t) * nRoomWords);
+    for (int room = 1; room <= nRooms; ++room) {
+        const RoomCalendar* calendar = store->calendars + room;
+        int pos = findStay(calendar, today);
+        if (pos < calendar->nStays && calendar->stays[pos].arrival <= today) {
+            store->roomIndex[room] = calendar->stays[pos].slot;
+            markRoom(store, room, 1);
+        }
+    }
+}
+
+// Build the bitmap of free rooms costing at most maxPrice per night, or of
+// every free room for ANY_PRICE
+void freeRooms(const BookingStore* store, int maxPrice, uint64_t rooms[MAX_ROOM_WORDS])
+{
+    roomsWithin(maxPrice, rooms);
+    for (int i = 0; i < nRoomWords; ++i) rooms[i] &= ~store->occupiedRooms[i];
+}
+
+// Count the free rooms costing at most maxPrice per night (or ANY_PRICE)
+int countFreeRooms(const BookingStore* store, int maxPrice)
+{
+    uint64_t rooms[MAX_ROOM_WORDS];
+    freeRooms(store, maxPrice, rooms);
+    return countRooms(rooms);
+}
+
+// Return the lowest numbered free room costing at most maxPrice per night
+// (or ANY_PRICE), or NO_ROOM
+int firstFreeRoom(const BookingStore* store, int maxPrice)
+{
+    uint64_t rooms[MAX_ROOM_WORDS];
+    freeRooms(store, maxPrice, rooms);
+    return nextRoom(rooms, 0);
+}
+
+// Build the bitmap of rooms costing at most maxPrice per night (or ANY_PRICE)
+// that are free for the whole of [arrival, departure). Each room costs one
+// binary search of its calendar
+void freeRoomsBetween(const BookingStore* store, int arrival, int departure, int maxPrice, uint64_t rooms[MAX_ROOM_WORDS])
+{
+    roomsWithin(maxPrice, rooms);
+    for (int room = nextRoom(rooms, 0); room != NO_ROOM; room = nextRoom(rooms, room)) {
+        if (!roomFreeBetween(store, room, arrival, departure)) {
+            rooms[(room - 1) / 64] &= ~(1ull << ((room - 1) % 64));
+        }
+    }
+}
+
+// Check whether a grid has a table free at a time slot (pm) on a day
+int gridTableFree(const DiningGrid* grid, int day, int table, int timeSlot)
+{
+    int slotIdx = timeSlotIndex(timeSlot);
+    if (table < 1 || table > nTables || slotIdx == -1) return 0;
+    if (day < grid->firstDay || day >= grid->firstDay + grid->nDays) return 1;
+    size_t rowSize = (size_t)nTimeSlots * nTables;
+    return !grid->cells[rowSize * (day - grid->firstDay) + slotIdx * nTables + table - 1];
+}
+
+// Make sure the dining grid has a row for a day, growing it towards the day
+// and leaving as much room again to grow further
+void coverDiningDay(DiningGrid* grid, int day)
+{
+    if (grid->nDays > 0 && day >= grid->firstDay && day < grid->firstDay + grid->nDays) return;
+    size_t rowSize = (size_t)nTimeSlots * nTables;
+    int firstDay = grid->nDays > 0 ? grid->firstDay : day;
+    int endDay = grid->nDays > 0 ? grid->firstDay + grid->nDays : day + DINING_INITIAL_DAYS;
+    while (day < firstDay) firstDay -= endDay - firstDay;
+    while (day >= endDay) endDay += endDay - firstDay;
+    int nDays = endDay - firstDay;
+    unsigned char* cells = resizeBuffer(NULL, rowSize * nDays);
+    memset(cells, 0, rowSize * nDays);
+    if (grid->nDays > 0) memcpy(cells + rowSize * (grid->firstDay - firstDay), grid->cells, rowSize * grid->nDays);
+    free(grid->cells);
+    grid->cells = cells;
+    grid->firstDay = firstDay;
+    grid->nDays = nDays;
+}
+
+// Check whether a booking in a slot holds a table that the grid can track
+int holdsTable(const BookingStore* store, int slot)
+{
+    int table = store->columns.tableNum[slot];
+    return table >= 1 && table <= nTables && timeSlotIndex(store->columns.tableSlot[slot]) != -1
+        && store->columns.tableDay[slot] != NO_DATE;
+}
+
+// Check whether a table is free at a time slot (pm) on a day
+int tableAvailable(const BookingStore* store, int day, int table, int timeSlot)
+{
+    return gridTableFree(&store->dining, day, table, timeSlot);
+}
+
+// Count the tables of a grid that are free on a day, at any time slot, and
+// find the first of them
+int countFreeTables(const DiningGrid* grid, int day, int* firstTable, int* firstSlot)
+{
+    int count = 0;
+    *firstTable = *firstSlot = INVALID_TABLE_ENTRY;
+    for (int i = 0; i < nTimeSlots; ++i) {
+        for (int table = 1; table <= nTables; ++table) {
+            if (!gridTableFree(grid, day, table, timeSlots[i])) continue;
+            if (count++ == 0) {
+                *firstTable = table;
+                *firstSlot = timeSlots[i];
+            }
+        }
+    }
+    return count;
+}
+
+// Take or release the table held by the booking in a slot
+void markTable(BookingStore* store, int slot, int taken)
+{
+    if (!holdsTable(store, slot)) return;
+    DiningGrid* grid = &store->dining;
+    int day = store->columns.tableDay[slot];
+    coverDiningDay(grid, day);
+    size_t rowSize = (size_t)nTimeSlots * nTables;
+    grid->cells[rowSize * (day - grid->firstDay) + timeSlotIndex(store->columns.tableSlot[slot]) * nTables
+                + store->columns.tableNum[slot] - 1] = taken;
+}
+
+// Move a booking's table reservation, keeping the dining grid current. A
+// table of INVALID_TABLE_ENTRY cancels it
+void setTable(BookingStore* store, int slot, int table, int timeSlot, int day)
+{
+    markTable(store, slot, 0);
+    store->columns.tableNum[slot] = table;
+    store->columns.tableSlot[slot] = timeSlot;
+    store->columns.tableDay[slot] = table > 0 ? day : NO_DATE;
+    markTable(store, slot, 1);
+}
+
+// Append a booking to the store and index it, returning its slot. Bookings
+// from before reservations had dates are treated as arriving today
+int addBooking(BookingStore* store, Booking booking)
+{
+    if (store->nBookings == store->capacity) {
+        store->capacity *= 2;
+        resizeColumns(&store->columns, store->capacity);
+    }
+    // Keep the hash table at most half full
+    if ((store->nBookings + 1) * 2 > store->idIndexSize) {
+        store->idIndexSize *= 2;
+        store->idIndex = resizeBuffer(store->idIndex, sizeof(int) * store->idIndexSize);
+        memset(store->idIndex, 0xff, sizeof(int) * store->idIndexSize);
+        for (int i = 0; i < store->nBookings; ++i) {
+            if (store->columns.id[i] != NULL) insertIdIndex(store, store->columns.id[i], i);
+        }
+    }
+    if (booking.roomNum >= store->roomIndexSize) {
+        int oldSize = store->roomIndexSize;
+        while (booking.roomNum >= store->roomIndexSize) store->roomIndexSize *= 2;
+        store->roomIndex = resizeBuffer(store->roomIndex, sizeof(int) * store->roomIndexSize);
+        memset(store->roomIndex + oldSize, 0xff, sizeof(int) * (store->roomIndexSize - oldSize));
+    }
+    // Legacy bookings were checked in when loaded, so their stay starts on
+    // the day they are first dated
+    if (booking.arrival == NO_DATE) {
+        booking.arrival = store->today;
+        booking.departure = store->today + (booking.nDays > 0 ? booking.nDays : 1);
+        store->nDatedOnLoad++;
+    }
+    // Table reservations from before they had dates are for the first night
+    if (booking.tableNum > 0 && booking.tableDay == NO_DATE) booking.tableDay = booking.arrival;
+    int slot = store->nBookings++;
+    setBooking(store, slot, &booking);
+    markTable(store, slot, 1);
+    if (booking.id != NULL) insertIdIndex(store, booking.id, slot);
+    addStay(store, &booking, slot);
+    // Only the stay covering today occupies the room now
+    if (booking.roomNum > 0 && booking.arrival <= store->today && store->today < booking.departure) {
+        store->roomIndex[booking.roomNum] = slot;
+        markRoom(store, booking.roomNum, 1);
+    }
+    return slot;
+}
+
+// A non-owning (pointer, length) view into the loaded booking data
+typedef struct {
+    char* ptr;
+    size_t len;
+} StringView;
+
+// Convert a view of decimal digits (with optional leading '-') to an integer
+int viewToInt(StringView view)
+{
+    int value = 0, sign = 1;
+    size_t i = 0;
+    if (view.len > 0 && view.ptr[0] == '-') {
+        sign = -1;
+        i = 1;
+    }
+    for (; i < view.len && isdigit((unsigned char)view.ptr[i]); ++i) {
+        value = value * 10 + (view.ptr[i] - '0');
+    }
+    return sign * value;
+}
+
+// Convert a view of a date (DD/MM/YYYY) into a day number, or NO_DATE if it
+// is not a valid date
+int viewToDay(StringView view)
+{
+    if (!matchesDatePattern(view.ptr, view.len)) return NO_DATE;
+    StringView day = { view.ptr, 2 }, month = { view.ptr + 3, 2 }, year = { view.ptr + 6, 4 };
+    int d = viewToInt(day), m = viewToInt(month), y = viewToInt(year);
+    if (m < 1 || m > 12 || d < 1 || d > monthLength(m, y)) return NO_DATE;
+    return dayNumber(d, m, y);
+}
+
+// Convert a date string (DD/MM/YYYY) into a day number, or NO_DATE
+int parseDate(const char* str)
+{
+    if (str == NULL) return NO_DATE;
+    StringView view = { (char*)str, strlen(str) };
+    return viewToDay(view);
+}
+
+// Convert a view of a board type code (FB, HB or BB) into a BoardType, or
+// NoBoard if it is not one
+BoardType viewToBoardType(StringView view)
+{
+    for (int type = FullBoard; type < N_BOARD_TYPES; ++type) {
+        if (view.len == 2 && memcmp(view.ptr, boardCodes[type], 2) == 0) return type;
+    }
+    return NoBoard;
+}
+
+// Convert a board type code string into a BoardType, or NoBoard
+BoardType parseBoardType(const char* str)
+{
+    if (str == NULL) return NoBoard;
+    StringView view = { (char*)str, strlen(str) };
+    return viewToBoardType(view);
+}
+
+// Read the field starting at cursor as a view, terminating it in place by
+// overwriting its delimiter, which is returned through delim ('\0' at the end
+// of the data). Returns the position after the delimiter
+char* nextField(char* cursor, char* end, StringView* field, char* delim)
+{
+    field->ptr = cursor;
+    while (cursor < end && *cursor != ',' && *cursor != ';' && *cursor != '\n' && *cursor != '\r') cursor++;
+    field->len = cursor - field->ptr;
+    *delim = cursor < end ? *cursor : '\0';
+    if (cursor < end) *cursor++ = '\0';
+    return cursor;
+}
+
+// Parse a single record of the text format in place, stopping at the end of
+// the record. Returns the position after the record
+char* parseRecord(char* cursor, char* end, Booking* booking, Arena* strings)
+{
+    memset(booking, 0, sizeof(Booking));
+    // Optional fields with default values
+    booking->tableNum = -1;
+    booking->tableSlot = -1;
+    booking->dob = NO_DATE;
+    booking->arrival = NO_DATE;
+    booking->departure = NO_DATE;
+    booking->tableDay = NO_DATE;
+    int fieldIdx = 0;
+    char delim = ',';
+    while (delim == ',') {
+        StringView field;
+        cursor = nextField(cursor, end, &field, &delim);
+        char* str = field.ptr;
+        if (delim == '\0' && (fieldIdx == firstName || fieldIdx == lastName || fieldIdx == id)) {
+            // A string field running into the end of the mapping cannot be
+            // terminated in place
+            str = arenaString(strings, field.ptr, field.len);
+        }
+        if (fieldIdx == firstName) booking->firstName = str;
+        if (fieldIdx == lastName) booking->lastName = str;
+        if (fieldIdx == dob) booking->dob = viewToDay(field);
+        if (fieldIdx == id) booking->id = str;
+        if (fieldIdx == boardType) booking->boardType = viewToBoardType(field);
+        if (fieldIdx == nDays) booking->nDays = viewToInt(field);
+        if (fieldIdx == nAdults) booking->nAdults = viewToInt(field);
+        if (fieldIdx == nChildren) booking->nChildren = viewToInt(field);
+        if (fieldIdx == paper) booking->paper = viewToInt(field);
+        if (fieldIdx == roomNum) booking->roomNum = viewToInt(field);
+        if (fieldIdx == tableNum) booking->tableNum = viewToInt(field);
+        if (fieldIdx == tableSlot) booking->tableSlot = viewToInt(field);
+        if (fieldIdx == arrival) booking->arrival = viewToDay(field);
+        if (fieldIdx == departure) booking->departure = viewToDay(field);
+        if (fieldIdx == tableDay) booking->tableDay = viewToDay(field);
+        fieldIdx++;
+    }
+    return cursor;
+}
+
+// Parse the .txt/.csv data in place and add a Booking object to the store for
+// each record. Fields are found as views and string fields are terminated by
+// overwriting the delimiter after them, so no record is ever copied
+int parseCSV(char* data, size_t size, BookingStore* store)
+{
+    char* cursor = data;
+    char* end = data + size;
+    int nParsed = 0;
+    while (cursor < end) {
+        // Skip the line break between records
+        while (cursor < end && isspace((unsigned char)*cursor)) cursor++;
+        if (cursor == end) break;
+        Booking booking;
+        cursor = parseRecord(cursor, end, &booking, &store->strings);
+        addBooking(store, booking);
+        nParsed++;
+    }
+    return nParsed;
+}
+
+// Removes a booking from the store in constant time by moving the last
+// booking into its slot, then pointing that booking's index entries at its
+// new slot. Slots are not stable across removals; booking ids are
+void removeBooking(BookingStore* store, int idx)
+{
+    Booking removed;
+    getBooking(store, idx, &removed);
+    if (removed.id != NULL) {
+        int pos = findIdIndexPos(store, removed.id, idx);
+        if (pos != -1) removeIdIndex(store, pos);
+    }
+    if (findBookingByRoom(store, removed.roomNum) == idx) {
+        store->roomIndex[removed.roomNum] = NO_BOOKING;
+        markRoom(store, removed.roomNum, 0);
+    }
+    removeStay(store, &removed, idx);
+    markTable(store, idx, 0);
+    int last = --store->nBookings;
+    if (idx == last) return;
+    Booking moved;
+    getBooking(store, last, &moved);
+    if (moved.id != NULL) {
+        int pos = findIdIndexPos(store, moved.id, last);
+        if (pos != -1) store->idIndex[pos] = idx;
+    }
+    if (findBookingByRoom(store, moved.roomNum) == last) store->roomIndex[moved.roomNum] = idx;
+    Stay* stay = findBookingStay(store, &moved, last);
+    if (stay != NULL) stay->slot = idx;
+    setBooking(store, idx, &moved);
+}
+
+// Map a file into memory copy-on-write, creating it if it does not exist, so
+// the parser can modify the data in place without touching the file on disk.
+// Returns NULL if the file is empty
+char* mapFile(const char* filename, size_t* size)
+{
+    char* data = NULL;
+#ifdef _WIN32
+    // Windows refuses to replace a file while a view of it is mapped, which
+    // would block every save, so the file is read into memory in one call
+    HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL,
+                              OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        printf("error: could not open %s\n", filename);
+        exit(EXIT_FAILURE);
+    }
+    LARGE_INTEGER fileSize;
+    GetFileSizeEx(file, &fileSize);
+    *size = (size_t)fileSize.QuadPart;
+    if (*size > 0) {
+        DWORD bytesRead = 0;
+        data = malloc(*size);
+        if (data != NULL && (!ReadFile(file, data, (DWORD)*size, &bytesRead, NULL) || bytesRead != *size)) {
+            free(data);
+            data = NULL;
+        }
+    }
+    CloseHandle(file);
+#else
+    int fd = open(filename, O_RDONLY | O_CREAT, 0644);
+    if (fd == -1) {
+        printf("error: could not open %s\n", filename);
+        exit(EXIT_FAILURE);
+    }
+    struct stat info;
+    fstat(fd, &info);
+    *size = (size_t)info.st_size;
+    if (*size > 0) {
+        data = mmap(NULL, *size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            data = NULL;
+        } else {
+            madvise(data, *size, MADV_SEQUENTIAL);
+        }
+    }
+    close(fd);
+#endif
+    if (*size > 0 && data == NULL) {
+        printf("error: could not load %s into memory\n", filename);
+        exit(EXIT_FAILURE);
+    }
+    return data;
+}
+
+// Release a mapping created by mapFile()
+void unmapFile(char* data, size_t size)
+{
+    if (data == NULL) return;
+#ifdef _WIN32
+    free(data);
+#else
+    munmap(data, size);
+#endif
+}
+
+// Atomically replace a file with another one
+void replaceFile(const char* source, const char* destination)
+{
+#ifdef _WIN32
+    int replaced = MoveFileExA(source, destination, MOVEFILE_REPLACE_EXISTING);
+#else
+    int replaced = rename(source, destination) == 0;
+#endif
+    if (!replaced) {
+        printf("error: could not replace %s\n", destination);
+        exit(EXIT_FAILURE);
+    }
+}
+
+// Flush a file's data all the way to the disk
+void syncFile(FILE* f)
+{
+    fflush(f);
+#ifdef _WIN32
+    _commit(_fileno(f));
+#else
+    fsync(fileno(f));
+#endif
+}
+
+// Buffered writer that formats data straight into a fixed block of memory
+// and only hands the file whole blocks
+typedef struct {
+    FILE* f;
+    char* data;
+    size_t len, capacity;
+} OutputBuffer;
+
+// Set up a writer for a file, using the given block of memory as its buffer
+void initOutput(OutputBuffer* out, FILE* f, char* data, size_t capacity)
+{
+    out->f = f;
+    out->data = data;
+    out->len = 0;
+    out->capacity = capacity;
+}
+
+// Write the buffered data to the file and empty the buffer
+void flushOutput(OutputBuffer* out)
+{
+    if (out->len > 0 && fwrite(out->data, 1, out->len, out->f) != out->len) {
+        printf("error: could not write data to disk\n");
+        exit(EXIT_FAILURE);
+    }
+    out->len = 0;
+}
+
+// Append a block of bytes to the output buffer
+void writeBytes(OutputBuffer* out, const char* bytes, size_t len)
+{
+    if (out->len + len > out->capacity) {
+        flushOutput(out);
+        // Too large to ever fit in the buffer, so write it directly
+        if (len > out->capacity) {
+            if (fwrite(bytes, 1, len, out->f) != len) {
+                printf("error: could not write data to disk\n");
+                exit(EXIT_FAILURE);
+            }
+            return;
+        }
+    }
+    memcpy(out->data + out->len, bytes, len);
+    out->len += len;
+}
+
+// Append a string to the output buffer, writing nothing for NULL
+void writeString(OutputBuffer* out, const char* str)
+{
+    if (str != NULL) writeBytes(out, str, strlen(str));
+}
+
+// Append the decimal representation of an integer to the output buffer
+void writeInt(OutputBuffer* out, int n)
+{
+    char digits[12];
+    int idx = sizeof(digits);
+    unsigned int value = n < 0 ? -(unsigned int)n : (unsigned int)n;
+    do {
+        digits[--idx] = '0' + value % 10;
+        value /= 10;
+    } while (value > 0);
+    if (n < 0) digits[--idx] = '-';
+    writeBytes(out, digits + idx, sizeof(digits) - idx);
+}
+
+// Append a date to the output buffer. NO_DATE is left as an empty field, which
+// reads back as NO_DATE, since formatting it would give a date in year -587
+void writeDay(OutputBuffer* out, int day)
+{
+    char date[11];
+    if (day == NO_DATE) return;
+    formatDay(day, date);
+    writeBytes(out, date, 10);
+}
+
+// Format a single booking as one record of the text format
+void writeBooking(OutputBuffer* out, const Booking* booking)
+{
+    writeString(out, booking->firstName);
+    writeBytes(out, ",", 1);
+    writeString(out, booking->lastName);
+    writeBytes(out, ",", 1);
+    writeDay(out, booking->dob);
+    writeBytes(out, ",", 1);
+    writeString(out, booking->id);
+    writeBytes(out, ",", 1);
+    writeString(out, boardCodes[booking->boardType]);
+    writeBytes(out, ",", 1);
+    writeInt(out, booking->nDays);
+    writeBytes(out, ",", 1);
+    writeInt(out, booking->nAdults);
+    writeBytes(out, ",", 1);
+    writeInt(out, booking->nChildren);
+    writeBytes(out, ",", 1);
+    writeInt(out, booking->paper);
+    writeBytes(out, ",", 1);
+    writeInt(out, booking->roomNum);
+    // The table fields are always written when the stay dates follow them
+    int hasTable = booking->tableNum != INVALID_TABLE_ENTRY && booking->tableSlot != INVALID_TABLE_ENTRY 
+        && booking->tableNum != TABLE_UNAVAILABLE && booking->tableSlot != TABLE_UNAVAILABLE;
+    if (hasTable || booking->arrival != NO_DATE) {
+        writeBytes(out, ",", 1);
+        writeInt(out, hasTable ? booking->tableNum : INVALID_TABLE_ENTRY);
+        writeBytes(out, ",", 1);
+        writeInt(out, hasTable ? booking->tableSlot : INVALID_TABLE_ENTRY);
+    }
+    if (booking->arrival != NO_DATE) {
+        writeBytes(out, ",", 1);
+        writeDay(out, booking->arrival);
+        writeBytes(out, ",", 1);
+        writeDay(out, booking->departure);
+        if (hasTable && booking->tableDay != NO_DATE) {
+            writeBytes(out, ",", 1);
+            writeDay(out, booking->tableDay);
+        }
+    }
+}
+
+/* Binary format */
+
+// Header at the start of a binary booking file. All integers are stored in
+// host byte order, which is little-endian on every platform the hotel runs on
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t nRecords;
+    uint32_t recordSize;
+    uint32_t heapOffset;
+    uint32_t heapSize;
+} BinaryHeader;
+
+// Fixed-width record following the header; the string fields are offsets into
+// the string heap at the end of the file, or NO_STRING
+typedef struct {
+    uint32_t firstName, lastName;
+    // Day number since version 3, before then a string heap offset
+    int32_t dob;
+    uint32_t id;
+    // BoardType value since version 4, before then a string heap offset
+    int32_t boardType;
+    int32_t nDays, nAdults, nChildren, paper, roomNum, tableNum, tableSlot;
+    // Added in version 2
+    int32_t arrival, departure;
+    // Added in version 5
+    int32_t tableDay;
+} BinaryRecord;
+
+// Size of the records written by version 1, which had no stay dates
+#define BINARY_RECORD_V1_SIZE offsetof(BinaryRecord, arrival)
+
+// Check whether loaded booking data is in the binary format
+int isBinaryBookingData(const char* data, size_t size)
+{
+    return size >= sizeof(BinaryHeader) && memcmp(data, BINARY_MAGIC, 4) == 0;
+}
+
+// Resolve a string heap offset to a pointer into the loaded data
+char* binaryString(char* heap, uint32_t heapSize, uint32_t offset)
+{
+    if (offset == NO_STRING || offset >= heapSize) return NULL;
+    return heap + offset;
+}
+
+// Read a single record from binary booking data without parsing the rest of
+// the file. Returns 0 if the index is out of range, or if the record or the
+// string heap does not lie within the size bytes of data
+int readBinaryBooking(char* data, size_t size, int idx, Booking* booking)
+{
+    BinaryHeader header;
+    BinaryRecord record;
+    if (size < sizeof(header)) return 0;
+    memcpy(&header, data, sizeof(header));
+    if (idx < 0 || (uint32_t)idx >= header.nRecords) return 0;
+    uint64_t offset = sizeof(header) + (uint64_t)idx * header.recordSize;
+    size_t recordSize = header.recordSize < sizeof(record) ? header.recordSize : sizeof(record);
+    if (offset + recordSize > size || (uint64_t)header.heapOffset + header.heapSize > size
+        || (header.heapSize > 0 && data[header.heapOffset + header.heapSize - 1] != '\0')) {
+        return 0;
+    }
+    // Older versions wrote shorter records, missing the fields added since
+    record.arrival = record.departure = record.tableDay = NO_DATE;
+    memcpy(&record, data + offset, recordSize);
+    char* heap = data + header.heapOffset;
+    booking->firstName = binaryString(heap, header.heapSize, record.firstName);
+    booking->lastName = binaryString(heap, header.heapSize, record.lastName);
+    booking->dob = header.version < 3 ? parseDate(binaryString(heap, header.heapSize, (uint32_t)record.dob)) : record.dob;
+    booking->id = binaryString(heap, header.heapSize, record.id);
+    booking->boardType = header.version < 4 ? parseBoardType(binaryString(heap, header.heapSize, (uint32_t)record.boardType))
+                                            : (record.boardType > NoBoard && record.boardType < N_BOARD_TYPES ? (BoardType)record.boardType : NoBoard);
+    booking->nDays = record.nDays;
+    booking->nAdults = record.nAdults;
+    booking->nChildren = record.nChildren;
+    booking->paper = record.paper;
+    booking->roomNum = record.roomNum;
+    booking->tableNum = record.tableNum;
+    booking->tableSlot = record.tableSlot;
+    booking->arrival = record.arrival;
+    booking->departure = record.departure;
+    booking->tableDay = record.tableDay;
+    booking->empty = 0;
+    return 1;
+}
+
+// Validate binary booking data and add every record to the store. The strings
+// are already terminated in the heap, so they are used where they lie
+int parseBinary(char* data, size_t size, BookingStore* store)
+{
+    BinaryHeader header;
+    memcpy(&header, data, sizeof(header));
+    if (header.version < 1 || header.version > BINARY_VERSION) {
+        printf("error: unsupported booking file version %u\n", header.version);
+        exit(EXIT_FAILURE);
+    }
+    if (header.recordSize < BINARY_RECORD_V1_SIZE
+        || sizeof(header) + (uint64_t)header.nRecords * header.recordSize > header.heapOffset
+        || (uint64_t)header.heapOffset + header.heapSize > size
+        || (header.heapSize > 0 && data[header.heapOffset + header.heapSize - 1] != '\0')) {
+        printf("error: booking file is corrupt\n");
+        exit(EXIT_FAILURE);
+    }
+    for (uint32_t i = 0; i < header.nRecords; ++i) {
+        Booking booking;
+        readBinaryBooking(data, size, i, &booking);
+        addBooking(store, booking);
+    }
+    return header.nRecords;
+}
+
+// Offset that the next string will take in the heap, advancing the heap size
+uint32_t reserveHeapString(const char* str, uint32_t* heapSize)
+{
+    if (str == NULL) return NO_STRING;
+    uint32_t offset = *heapSize;
+    *heapSize += strlen(str) + 1;
+    return offset;
+}
+
+// Serialize the booking store into the binary format: the header, then every
+// fixed-width record, then the string heap the records point into
+void writeBinaryBookings(OutputBuffer* out, const BookingStore* store)
+{
+    BinaryHeader header;
+    memcpy(header.magic, BINARY_MAGIC, 4);
+    header.version = BINARY_VERSION;
+    header.nRecords = store->nBookings;
+    header.recordSize = sizeof(BinaryRecord);
+    header.heapOffset = sizeof(header) + store->nBookings * sizeof(BinaryRecord);
+    header.heapSize = 0;
+    for (int i = 0; i < store->nBookings; ++i) {
+        reserveHeapString(store->columns.firstName[i], &header.heapSize);
+        reserveHeapString(store->columns.lastName[i], &header.heapSize);
+        reserveHeapString(store->columns.id[i], &header.heapSize);
+    }
+    writeBytes(out, (const char*)&header, sizeof(header));
+    uint32_t heapSize = 0;
+    for (int i = 0; i < store->nBookings; ++i) {
+        Booking booking;
+        getBooking(store, i, &booking);
+        BinaryRecord record;
+        record.firstName = reserveHeapString(booking.firstName, &heapSize);
+        record.lastName = reserveHeapString(booking.lastName, &heapSize);
+        record.dob = booking.dob;
+        record.id = reserveHeapString(booking.id, &heapSize);
+        record.boardType = booking.boardType;
+        record.nDays = booking.nDays;
+        record.nAdults = booking.nAdults;
+        record.nChildren = booking.nChildren;
+        record.paper = booking.paper;
+        record.roomNum = booking.roomNum;
+        record.tableNum = booking.tableNum;
+        record.tableSlot = booking.tableSlot;
+        record.arrival = booking.arrival;
+        record.departure = booking.departure;
+        record.tableDay = booking.tableDay;
+        writeBytes(out, (const char*)&record, sizeof(record));
+    }
+    for (int i = 0; i < store->nBookings; ++i) {
+        const char* strings[] = { store->columns.firstName[i], store->columns.lastName[i], store->columns.id[i] };
+        for (int j = 0; j < 3; ++j) {
+            if (strings[j] != NULL) writeBytes(out, strings[j], strlen(strings[j]) + 1);
+        }
+    }
+}
+
+// Serialize the booking store into the text format
+void writeTextBookings(OutputBuffer* out, const BookingStore* store)
+{
+    for (int i = 0; i < store->nBookings; ++i) {
+        Booking booking;
+        getBooking(store, i, &booking);
+        writeBooking(out, &booking);
+        if ((i + 1) != store->nBookings) {
+            writeBytes(out, ";\n", 2);
+        }
+    }
+}
+
+// High level function to serialize the booking store straight into a
+// buffered file in a single pass and save it, in the store's format
+void saveBookingData(const char* filename, const BookingStore* store)
+{
+    // Write a new file and rename it over the old one, rather than truncating
+    // the file that the loaded bookings are still mapped from
+    char tempFilename[FILENAME_MAX];
+    snprintf(tempFilename, sizeof(tempFilename), "%s.tmp", filename);
+    FILE* f = fopen(tempFilename, store->binary ? "wb" : "w");
+    char* block = malloc(OUTPUT_BUFFER_SIZE);
+    if (f == NULL || block == NULL) {
+        printf("error: could not write data to disk\n");
+        exit(EXIT_FAILURE);
+    }
+    OutputBuffer out;
+    initOutput(&out, f, block, OUTPUT_BUFFER_SIZE);
+    if (store->binary) {
+        writeBinaryBookings(&out, store);
+    } else {
+        writeTextBookings(&out, store);
+    }
+    flushOutput(&out);
+    // The new file must be on disk before it replaces the old one, or a crash
+    // could leave an empty or truncated file behind the rename
+    syncFile(f);
+    fclose(f);
+    free(block);
+    replaceFile(tempFilename, filename);
+}
+
+/* Journal */
+
+// Name of the journal that belongs to a booking file
+void journalFilename(char* buffer, size_t size, const char* filename)
+{
+    snprintf(buffer, size, "%s.log", filename);
+}
+
+// Name of the history of bills that belongs to a booking file
+void billsFilename(char* buffer, size_t size, const char* filename)
+{
+    snprintf(buffer, size, "%s.bills", filename);
+}
+
+// Name of the booking id sequence counter that belongs to a booking file
+void sequenceFilename(char* buffer, size_t size, const char* filename)
+{
+    snprintf(buffer, size, "%s.seq", filename);
+}
+
+// Open the journal of the store's booking file for appending
+void openJournal(BookingStore* store)
+{
+    char filename[FILENAME_MAX];
+    journalFilename(filename, sizeof(filename), store->filename);
+    store->journal = fopen(filename, "a");
+    if (store->journal == NULL) {
+        printf("error: could not open %s\n", filename);
+        exit(EXIT_FAILURE);
+    }
+}
+
+// Fold the journal back into the booking file: the full booking set is saved
+// as a new snapshot and only then is the journal emptied. A crash in between
+// is harmless, as replaying the journal over the new snapshot is idempotent
+void compactBookingData(BookingStore* store)
+{
+    char filename[FILENAME_MAX];
+    journalFilename(filename, sizeof(filename), store->filename);
+    saveBookingData(store->filename, store);
+    if (store->journal != NULL) fclose(store->journal);
+    // Unlink rather than truncate, as replayed strings may point into the old file
+    remove(filename);
+    openJournal(store);
+    store->nJournalEntries = 0;
+    store->journalApplied = 0;
+    store->nDatedOnLoad = 0;
+    // Other processes must now reload rather than replay the old journal
+    if (store->stamp != NULL) {
+        store->generation++;
+        rewind(store->stamp);
+        fprintf(store->stamp, "%ld\n", store->generation);
+        fflush(store->stamp);
+    }
+}
+
+// Make a journal record durable, compacting the journal once it grows large
+void appendJournal(BookingStore* store, OutputBuffer* out)
+{
+    writeBytes(out, "\n", 1);
+    flushOutput(out);
+    if (!store->deferSync) syncFile(store->journal);
+    store->journalApplied = ftell(store->journal);
+    if (++store->nJournalEntries >= JOURNAL_COMPACT_THRESHOLD) compactBookingData(store);
+}
+
+// Log a new booking
+void logAddBooking(BookingStore* store, const Booking* booking)
+{
+    char block[JOURNAL_BLOCK_SIZE];
+    OutputBuffer out;
+    initOutput(&out, store->journal, block, sizeof(block));
+    writeBytes(&out, "A ", 2);
+    writeBooking(&out, booking);
+    appendJournal(store, &out);
+}
+
+// Log a change to a booking's table reservation, including cancellations
+void logTableBooking(BookingStore* store, int idx)
+{
+    char block[JOURNAL_BLOCK_SIZE];
+    OutputBuffer out;
+    initOutput(&out, store->journal, block, sizeof(block));
+    writeBytes(&out, "T ", 2);
+    writeString(&out, store->columns.id[idx]);
+    writeBytes(&out, ",", 1);
+    writeInt(&out, store->columns.tableNum[idx]);
+    writeBytes(&out, ",", 1);
+    writeInt(&out, store->columns.tableSlot[idx]);
+    if (store->columns.tableDay[idx] != NO_DATE) {
+        char date[11];
+        formatDay(store->columns.tableDay[idx], date);
+        writeBytes(&out, ",", 1);
+        writeBytes(&out, date, 10);
+    }
+    appendJournal(store, &out);
+}
+
+// Log the removal of a booking when its guest checks out
+void logRemoveBooking(BookingStore* store, const char* id)
+{
+    char block[JOURNAL_BLOCK_SIZE];
+    OutputBuffer out;
+    initOutput(&out, store->journal, block, sizeof(block));
+    writeBytes(&out, "R ", 2);
+    writeString(&out, id);
+    appendJournal(store, &out);
+}
+
+// Apply the journal records to the store in order, returning the number of
+// records that were replayed. A torn record at the end of the journal, left by
+// a crash mid-write, is ignored and reported through torn. Transient data is
+// reused once replayed, so the strings of the bookings it adds are copied
+int replayJournal(char* data, size_t size, int transient, BookingStore* store, int* torn)
+{
+    char* cursor = data;
+    char* end = data + size;
+    int nReplayed = 0;
+    *torn = 0;
+    while (cursor < end) {
+        char* lineEnd = memchr(cursor, '\n', end - cursor);
+        if (lineEnd == NULL) {
+            *torn = 1;
+            break;
+        }
+        if (lineEnd - cursor < 2) {
+            cursor = lineEnd + 1;
+            continue;
+        }
+        char type = *cursor;
+        cursor += 2;
+        if (type == 'A') {
+            Booking booking;
+            parseRecord(cursor, lineEnd, &booking, &store->strings);
+            // Already present if the journal outlived a compaction
+            if (booking.id != NULL && findBookingById(store, booking.id) == NO_BOOKING) {
+                if (transient) {
+                    booking.firstName = arenaCopy(&store->strings, booking.firstName);
+                    booking.lastName = arenaCopy(&store->strings, booking.lastName);
+                    booking.id = arenaCopy(&store->strings, booking.id);
+                }
+                addBooking(store, booking);
+            }
+        } else if (type == 'T') {
+            StringView bookingId, table, slot, day = { NULL, 0 };
+            char delim;
+            char* field = nextField(cursor, lineEnd, &bookingId, &delim);
+            field = nextField(field, lineEnd, &table, &delim);
+            field = nextField(field, lineEnd, &slot, &delim);
+            if (delim == ',') nextField(field, lineEnd, &day, &delim);
+            int idx = findBookingById(store, bookingId.ptr);
+            if (idx != NO_BOOKING) {
+                // Records from before reservations had dates are for the first night
+                int tableDay = day.ptr != NULL ? viewToDay(day) : store->columns.arrival[idx];
+                setTable(store, idx, viewToInt(table), viewToInt(slot), tableDay);
+            }
+        } else if (type == 'R') {
+            *lineEnd = '\0';
+            int idx = findBookingById(store, cursor);
+            if (idx != NO_BOOKING) removeBooking(store, idx);
+        }
+        nReplayed++;
+        cursor = lineEnd + 1;
+    }
+    return nReplayed;
+}
+
+// Read the booking data from a file into an empty store and replay its
+// journal on top. The store keeps both files mapped, since the loaded strings
+// point into them, and keeps the journal open for appending
+void readBookingData(const char* filename, BookingStore* store)
+{
+    char journal[FILENAME_MAX];
+    int torn = 0;
+    store->filename = filename;
+    store->mappedData = mapFile(filename, &store->mappedSize);
+    store->binary = store->mappedData != NULL && isBinaryBookingData(store->mappedData, store->mappedSize);
+    if (store->binary) {
+        parseBinary(store->mappedData, store->mappedSize, store);
+    } else if (store->mappedData != NULL) {
+        parseCSV(store->mappedData, store->mappedSize, store);
+    }
+    journalFilename(journal, sizeof(journal), filename);
+    store->journalData = mapFile(journal, &store->journalSize);
+    if (store->journalData != NULL) {
+        store->nJournalEntries = replayJournal(store->journalData, store->journalSize, 0, store, &torn);
+    }
+    store->journalApplied = store->journalSize;
+    if (store->readOnly) return;
+    openJournal(store);
+    // A torn record must not have new records appended to it, and legacy
+    // bookings are saved with the dates they were given
+    if (torn || store->nDatedOnLoad > 0 || store->nJournalEntries >= JOURNAL_COMPACT_THRESHOLD) {
+        compactBookingData(store);
+    }
+}
+
+// Open a file shared between processes for reading and writing, creating it
+// if it does not exist. Unlike falling back from "r+" to "w+", this never
+// truncates a file that another process created and wrote in the meantime
+FILE* openSharedFile(const char* filename)
+{
+#ifdef _WIN32
+    int fd = _open(filename, _O_RDWR | _O_CREAT, _S_IREAD | _S_IWRITE);
+    FILE* f = fd == -1 ? NULL : _fdopen(fd, "r+");
+    if (fd != -1 && f == NULL) _close(fd);
+#else
+    int fd = open(filename, O_RDWR | O_CREAT, 0644);
+    FILE* f = fd == -1 ? NULL : fdopen(fd, "r+");
+    if (fd != -1 && f == NULL) close(fd);
+#endif
+    if (f == NULL) {
+        printf("error: could not open %s\n", filename);
+        exit(EXIT_FAILURE);
+    }
+    return f;
+}
+
+// Lock or unlock the first byte of an open file, blocking until the lock is
+// granted so that other processes sharing the file are serialised
+void lockFile(FILE* f, int lock)
+{
+    rewind(f);
+#ifdef _WIN32
+    _locking(_fileno(f), lock ? _LK_LOCK : _LK_UNLCK, 1);
+#else
+    lockf(fileno(f), lock ? F_LOCK : F_ULOCK, 1);
+#endif
+}
+
+// Try to lock one byte of an open file without waiting, returning whether the
+// lock was granted
+int tryLockByte(FILE* f, long byte)
+{
+    fseek(f, byte, SEEK_SET);
+#ifdef _WIN32
+    return _locking(_fileno(f), _LK_NBLCK, 1) == 0;
+#else
+    return lockf(fileno(f), F_TLOCK, 1) == 0;
+#endif
+}
+
+// Unlock one byte of an open file
+void unlockByte(FILE* f, long byte)
+{
+    fseek(f, byte, SEEK_SET);
+#ifdef _WIN32
+    _locking(_fileno(f), _LK_UNLCK, 1);
+#else
+    lockf(fileno(f), F_ULOCK, 1);
+#endif
+}
+
+// Reload a store from its files after another process compacted them. The
+// arena is released with the rest of the store, so strings that must outlive
+// a reload are kept elsewhere (see deskStrings). The lock file is kept, as
+// closing it would drop the lock
+void reloadBookingData(BookingStore* store)
+{
+    const char* filename = store->filename;
+    FILE* stamp = store->stamp, *bills = store->bills;
+    long generation = store->generation;
+    int lockDepth = store->lockDepth, deferSync = store->deferSync;
+    store->stamp = store->bills = NULL;
+    freeBookingStore(store);
+    initBookingStore(store);
+    store->stamp = stamp;
+    store->bills = bills;
+    store->generation = generation;
+    store->lockDepth = lockDepth;
+    store->deferSync = deferSync;
+    readBookingData(filename, store);
+}
+
+// Replay the journal records that other processes appended since this store
+// last caught up. They are read into a buffer that is reused by the next
+// catch-up, so only the strings of the bookings they add are copied
+void catchUpJournal(BookingStore* store, long journalSize)
+{
+    char filename[FILENAME_MAX];
+    journalFilename(filename, sizeof(filename), store->filename);
+    size_t size = journalSize - store->journalApplied;
+    if (size + 1 > store->catchUpCapacity) {
+        store->catchUpCapacity = size + 1 > JOURNAL_BLOCK_SIZE ? size + 1 : JOURNAL_BLOCK_SIZE;
+        store->catchUpData = resizeBuffer(store->catchUpData, store->catchUpCapacity);
+    }
+    char* data = store->catchUpData;
+    FILE* f = fopen(filename, "rb");
+    if (f == NULL || fseek(f, store->journalApplied, SEEK_SET) != 0 || fread(data, 1, size, f) != size) {
+        printf("error: could not read %s\n", filename);
+        exit(EXIT_FAILURE);
+    }
+    fclose(f);
+    data[size] = '\0';
+    int torn = 0;
+    store->nJournalEntries += replayJournal(data, size, 1, store, &torn);
+    store->journalApplied = journalSize;
+    // A writer that crashed mid-record leaves a torn record to be folded away
+    if (torn || store->nJournalEntries >= JOURNAL_COMPACT_THRESHOLD) compactBookingData(store);
+}
+
+// Take the advisory lock on a store's booking data, trying up to attempts
+// times while another process holds it, and bring the store up to date with
+// the changes other processes made. A stale store is reloaded if the booking
+// file was compacted since, or else replays the new journal records. Returns 1
+// if the store had to catch up, in which case decisions taken against it must
+// be checked again, or LOCK_BUSY without the lock if another process kept it
+// for every attempt. Nested calls only count the depth
+int lockBookingDataWithin(BookingStore* store, int attempts)
+{
+    if (store->lockDepth > 0) {
+        store->lockDepth++;
+        return 0;
+    }
+    if (store->stamp == NULL) {
+        char filename[FILENAME_MAX];
+        snprintf(filename, sizeof(filename), "%s.lock", store->filename);
+        store->stamp = openSharedFile(filename);
+        // The generation is written by other processes, so it is never buffered
+        setvbuf(store->stamp, NULL, _IONBF, 0);
+    }
+    // A process that has to wait flags it on the waiting byte, so that a long
+    // run holding the lock hands it over (see yieldBookingData)
+    int waiting = 0;
+    for (int attempt = 1; !tryLockByte(store->stamp, DATA_LOCK_BYTE); ++attempt) {
+        if (!waiting) waiting = tryLockByte(store->stamp, WAITING_LOCK_BYTE);
+        if (attempt >= attempts) {
+            if (waiting) unlockByte(store->stamp, WAITING_LOCK_BYTE);
+            return LOCK_BUSY;
+        }
+        sleepMs(LOCK_RETRY_MS);
+    }
+    if (waiting) unlockByte(store->stamp, WAITING_LOCK_BYTE);
+    store->lockDepth = 1;
+    long generation = 0;
+    rewind(store->stamp);
+    if (fscanf(store->stamp, "%ld", &generation) != 1) generation = 0;
+    if (generation != store->generation) {
+        store->generation = generation;
+        reloadBookingData(store);
+        return 1;
+    }
+    fseek(store->journal, 0, SEEK_END);
+    long journalSize = ftell(store->journal);
+    if (journalSize == store->journalApplied) return 0;
+    catchUpJournal(store, journalSize);
+    return 1;
+}
+
+// Take the advisory lock on a store's booking data, waiting up to
+// LOCK_ATTEMPTS * LOCK_RETRY_MS for another process to release it
+int lockBookingData(BookingStore* store)
+{
+    return lockBookingDataWithin(store, LOCK_ATTEMPTS);
+}
+
+// Release the advisory lock taken by lockBookingData
+void unlockBookingData(BookingStore* store)
+{
+    if (--store->lockDepth > 0) return;
+    // Other processes read the journal as soon as the lock is released, so
+    // records whose sync was deferred must at least reach the file
+    if (store->journal != NULL) fflush(store->journal);
+    unlockByte(store->stamp, DATA_LOCK_BYTE);
+}
+
+// Take the lock on the booking data for work that cannot be given up, waiting
+// for as long as other processes hold it. Returns 1 if the store had to catch
+// up
+int waitForBookingData(BookingStore* store)
+{
+    int stale;
+    while ((stale = lockBookingData(store)) == LOCK_BUSY);
+    return stale;
+}
+
+// Let a process that is waiting for the booking data have it, then take it
+// back. Runs that hold the lock for many changes call this between them, so
+// that other desks wait for a chunk of work rather than the whole run. Returns
+// 1 if the store had to catch up
+int yieldBookingData(BookingStore* store)
+{
+    if (store->lockDepth != 1) return 0;
+    // The waiter keeps the waiting byte until it has taken the lock
+    if (tryLockByte(store->stamp, WAITING_LOCK_BYTE)) {
+        unlockByte(store->stamp, WAITING_LOCK_BYTE);
+        return 0;
+    }
+    unlockBookingData(store);
+    while (!tryLockByte(store->stamp, WAITING_LOCK_BYTE)) sleepMs(1);
+    unlockByte(store->stamp, WAITING_LOCK_BYTE);
+    return waitForBookingData(store);
+}
+
+// Name of the file in which a running server leaves the path of its socket
+void serverFilename(char* buffer, size_t size, const char* filename)
+{
+    snprintf(buffer, size, "%s.server", filename);
+}
+
+// Find the server that holds the lock on a booking file for as long as it
+// runs, copying the path of its socket into path. Returns 0 if no server is
+// answering on the path it left behind
+int findBookingServer(const char* filename, char* path, size_t size)
+{
+#ifdef _WIN32
+    return 0;
+#else
+    char serverFile[FILENAME_MAX];
+    serverFilename(serverFile, sizeof(serverFile), filename);
+    FILE* f = fopen(serverFile, "r");
+    if (f == NULL) return 0;
+    int found = fgets(path, (int)size, f) != NULL;
+    fclose(f);
+    if (!found) return 0;
+    path[strcspn(path, "\n")] = '\0';
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, path, sizeof(address.sun_path) - 1);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    found = fd >= 0 && connect(fd, (struct sockaddr*)&address, sizeof(address)) == 0;
+    if (fd >= 0) close(fd);
+    return found;
+#endif
+}
+
+// High level function to load the booking data into an empty store under the
+// advisory lock, returning the number of bookings that were loaded. Exits at
+// once if a server holds the lock, as it never lets go of it, or if another
+// process holds it for the whole wait
+int loadBookingData(const char* filename, BookingStore* store)
+{
+    store->filename = filename;
+    char path[FILENAME_MAX];
+    if (lockBookingDataWithin(store, 1) == LOCK_BUSY && findBookingServer(filename, path, sizeof(path))) {
+        printf("error: the bookings in %s are served by %s; use --connect %s\n", filename, path, path);
+        exit(EXIT_FAILURE);
+    }
+    if (store->lockDepth == 0 && lockBookingData(store) == LOCK_BUSY) {
+        printf("error: the bookings in %s are in use by another process\n", filename);
+        exit(EXIT_FAILURE);
+    }
+    unlockBookingData(store);
+    return store->nBookings;
+}
+
+// Get whether a file was replaced or changed between two stat calls
+int fileChanged(const struct stat* before, const struct stat* after)
+{
+    return before->st_ino != after->st_ino || before->st_size != after->st_size || before->st_mtime != after->st_mtime;
+}
+
+// Load the booking data into an empty store without taking the lock, for work
+// that only reads it, such as reports, so that it can run while a server
+// holds the lock. Nothing is written back: torn journal records are skipped,
+// and legacy bookings are dated in memory only. If another process compacts
+// the booking file meanwhile, the load starts again from the new file.
+// Returns the number of bookings that were loaded
+int loadBookingSnapshot(const char* filename, BookingStore* store)
+{
+    for (;;) {
+        struct stat before, after;
+        int existed = stat(filename, &before) == 0;
+        store->readOnly = 1;
+        readBookingData(filename, store);
+        int exists = stat(filename, &after) == 0;
+        if (exists == existed && (!exists || !fileChanged(&before, &after))) break;
+        freeBookingStore(store);
+        initBookingStore(store);
+    }
+    return store->nBookings;
+}
+
+// Reserve a block of count booking id sequence numbers, returning the first.
+// The counter is persisted next to the booking data and held under a file lock
+// while it is advanced, so concurrent check-ins never receive the same number
+long reserveBookingSequences(const BookingStore* store, long count)
+{
+    char filename[FILENAME_MAX];
+    sequenceFilename(filename, sizeof(filename), store->filename);
+    FILE* f = openSharedFile(filename);
+    lockFile(f, 1);
+    long sequence = 0;
+    if (fscanf(f, "%ld", &sequence) != 1 || sequence < FIRST_SEQUENCE) sequence = FIRST_SEQUENCE;
+    rewind(f);
+    fprintf(f, "%ld\n", sequence + count);
+    // The range is only handed out once the advanced counter is on disk, so
+    // a crash cannot issue the same ids again after a restart
+    syncFile(f);
+    lockFile(f, 0);
+    fclose(f);
+    return sequence;
+}
+
+// Reserve the next booking id sequence number
+long nextBookingSequence(const BookingStore* store)
+{
+    return reserveBookingSequences(store, 1);
+}
+
+// Read a line from stdin. The line is kept in a buffer that is reused by the
+// next call, so strings that are stored must be copied out of it
+char* inputString()
+{
+    static char* buffer = NULL;
+    static size_t size = 0;
+    int ch = 0;
+    size_t len = 0;
+    while ((ch = fgetc(stdin)) != EOF && ch != '\n') {
+        if (len + 1 >= size) {
+            size = size ? size * 2 : 64;
+            buffer = resizeBuffer(buffer, size);
+        }
+        buffer[len++] = ch;
+    }
+    // Every prompt asks again until it is answered, so the session ends with
+    // its input rather than prompting forever
+    if (ch == EOF && len == 0) exit(EXIT_SUCCESS);
+    if (buffer == NULL) buffer = resizeBuffer(NULL, size = 64);
+    buffer[len] = '\0';
+    return buffer;
+}
+
+// Read a line from stdin holding a whole number, or -1 if it holds anything
+// else. Numbers are read a line at a time, so that no answer is left behind
+// for the next prompt
+int inputInt()
+{
+    char* line = trim(inputString());
+    size_t len = strlen(line);
+    if (len == 0 || len > 9 || spanCharClass(&digitClass, line) != len) return -1;
+    StringView view = { line, len };
+    return viewToInt(view);
+}
+
+// Read a yes or no answer from stdin, returning 'y', 'n' or 0 for anything
+// else
+char inputYesNo()
+{
+    char* line = trim(inputString());
+    if (strcmp(line, "Y") == 0 || strcmp(line, "y") == 0) return 'y';
+    if (strcmp(line, "N") == 0 || strcmp(line, "n") == 0) return 'n';
+    return 0;
+}
+
+// Parse a datetime string (DD/MM/YYYY) into integer components for the day, month and year
+void parseDateTimeString(const char* str, int* birthDay, int* birthMonth, int* birthYear)
+{
+    // Parse string passed in
+    char birthDayString[3], birthMonthString[3], birthYearString[5];
+    strncpy(birthDayString, str, 2);
+    birthDayString[2] = '\0';
+    strncpy(birthMonthString, str + 3, 2);
+    birthMonthString[2] = '\0';
+    strncpy(birthYearString, str + 6, 4);
+    birthYearString[4] = '\0';
+    *birthDay = atoi(birthDayString);
+    *birthMonth = atoi(birthMonthString);
+    *birthYear = atoi(birthYearString);
+}
+
+// Messages for a day outside of a month, indexed by the month length - 28
+static const char* dayErrors[4] = {
+    "Day must be between 1 and 28!", "Day must be between 1 and 29!",
+    "Day must be between 1 and 30!", "Day must be between 1 and 31!"
+};
+
+// Check a date of birth against the given day, returning NULL if it is
+// valid, otherwise a message ("" for a malformed date). Does not print, so
+// rows can be checked on several threads at once
+const char* dobError(const char* str, int today)
+{
+    if (!matchesDatePattern(str, strlen(str))) {
+        return "";
+    }
+
+    // Parse string passed in
+    int birthDay, birthMonth, birthYear;
+    parseDateTimeString(str, &birthDay, &birthMonth, &birthYear);
+
+    // Month is between 1 and 12
+    if (birthMonth > 12 || birthMonth < 1) {
+        return "Month must be between 1 and 12!";
+    }
+    // Day is within the month, allowing for leap years
+    if (birthDay < 1 || birthDay > monthLength(birthMonth, birthYear)) {
+        return dayErrors[monthLength(birthMonth, birthYear) - 28];
+    }
+    if (birthYear < 1900) {
+        return "Invalid date!";
+    }
+
+    // A guest born on 29/02 comes of age on 01/03 in non-leap years, which is
+    // where dayNumber() places the 29th
+    if (today < dayNumber(birthDay, birthMonth, birthYear)) {
+        return "Invalid age!";
+    } else if (today < dayNumber(birthDay, birthMonth, birthYear + 18)) {
+        return "You must be over 18 to book a room.";
+    }
+    return NULL;
+}
+
+// Validate that the user has inputted a valid date of birth
+int validDOB(char* str)
+{
+    const char* error = dobError(str, currentDay());
+    if (error != NULL && *error != '\0') printf("%s\n", error);
+    return error == NULL;
+}
+
+/* Billing */
+
+// Rates derived from the tariff once it is loaded, so that billing a stay is
+// only lookups and multiplications. Indexed like the tariff
+typedef struct {
+    int *roomNight, *seniorDiscount;
+    int adultMeal[N_BOARD_TYPES], childMeal[N_BOARD_TYPES];
+} Rates;
+
+static Rates rates;
+
+// One charge or discount on an invoice, in pence
+typedef struct {
+    const char* item;
+    int quantity, unitPrice;
+    int64_t amount;
+} InvoiceLine;
+
+// Itemised bill for a stay
+typedef struct {
+    InvoiceLine lines[MAX_INVOICE_LINES];
+    int nLines;
+    int64_t total;
+    // The total split into the room, less any discount, the meals and the
+    // newspaper
+    int64_t room, board, paper;
+} Invoice;
+
+// Take a percentage of an amount in pence, rounding to the nearest penny
+int percentOf(int amount, int percent)
+{
+    return (int)(((int64_t)amount * percent + 50) / 100);
+}
+
+// Derive the rates from the tariff
+void buildRates()
+{
+    rates.roomNight = resizeBuffer(rates.roomNight, sizeof(int) * (nRooms + 1));
+    rates.seniorDiscount = resizeBuffer(rates.seniorDiscount, sizeof(int) * (nRooms + 1));
+    for (int room = 0; room <= nRooms; ++room) {
+        rates.roomNight[room] = tariff.roomRates[room];
+        rates.seniorDiscount[room] = percentOf(tariff.roomRates[room], tariff.seniorPercent);
+    }
+    for (int type = 0; type < N_BOARD_TYPES; ++type) {
+        rates.adultMeal[type] = tariff.boardRates[type];
+        rates.childMeal[type] = percentOf(tariff.boardRates[type], tariff.childPercent);
+    }
+}
+
+// Parse an amount of money in pounds, with up to two decimal places, into
+// pence. Returns -1 if it is not a valid amount
+int viewToPence(StringView view)
+{
+    int64_t pence = 0;
+    size_t i = 0;
+    for (; i < view.len && view.ptr[i] >= '0' && view.ptr[i] <= '9' && pence <= INT_MAX; ++i) {
+        pence = pence * 10 + (view.ptr[i] - '0');
+    }
+    if (i == 0) return -1;
+    pence *= 100;
+    if (i < view.len && view.ptr[i] == '.') {
+        size_t nDecimals = view.len - i - 1;
+        if (nDecimals < 1 || nDecimals > 2) return -1;
+        for (size_t j = 0; j < 2; ++j) {
+            char c = j < nDecimals ? view.ptr[i + 1 + j] : '0';
+            if (c < '0' || c > '9') return -1;
+            pence += (c - '0') * (j == 0 ? 10 : 1);
+        }
+        i = view.len;
+    }
+    return i == view.len && pence <= INT_MAX ? (int)pence : -1;
+}
+
+// Format an amount in pence as pounds and pence
+void formatMoney(int64_t pence, char* buffer)
+{
+    int64_t magnitude = pence < 0 ? -pence : pence;
+    snprintf(buffer, MONEY_SIZE, "%s%lld.%02lld", pence < 0 ? "-" : "", (long long)(magnitude / 100), (long long)(magnitude % 100));
+}
+
+int splitFields(char* str, StringView* fields, int maxFields);
+
+// Load the tariff from a file with one price per line, replacing the default
+// prices it names. Prices are in pounds and may have pence:
+//   rooms,<number of rooms>
+//   room,<room number>,<price per night>
+//   board,<FB|HB|BB>,<price per person per meal>[,<meals per night>]
+//   child,<percent of the adult board price>
+//   paper,<price per stay>
+//   senior,<age>,<percent off the room>
+void loadTariff(const char* filename)
+{
+    FILE* f = fopen(filename, "r");
+    if (f == NULL) {
+        printf("error: could not open %s\n", filename);
+        exit(EXIT_FAILURE);
+    }
+    char line[256];
+    int lineNum = 0;
+    // The hotel has the rooms the tariff prices, or as many as it says. Rooms
+    // past the default ones must all be priced
+    int count = 0, highestRoom = 0;
+    int* roomRates = resizeBuffer(NULL, sizeof(int) * (MAX_ROOMS + 1));
+    for (int room = 0; room <= MAX_ROOMS; ++room) roomRates[room] = room <= nRooms ? tariff.roomRates[room] : -1;
+    while (fgets(line, sizeof(line), f) != NULL) {
+        lineNum++;
+        char* entry = trim(line);
+        if (*entry == '\0' || *entry == '#') continue;
+        StringView fields[4];
+        int nFields = splitFields(entry, fields, 4);
+        const char* kind = fields[0].ptr;
+        int valid = 0;
+        if (strcmp(kind, "rooms") == 0 && nFields == 2) {
+            count = viewToInt(fields[1]);
+            valid = count >= 1 && count <= MAX_ROOMS;
+        } else if (strcmp(kind, "room") == 0 && nFields == 3) {
+            int room = viewToInt(fields[1]), price = viewToPence(fields[2]);
+            valid = room >= 1 && room <= MAX_ROOMS && price >= 0;
+            if (valid) {
+                roomRates[room] = price;
+                if (room > highestRoom) highestRoom = room;
+            }
+        } else if (strcmp(kind, "board") == 0 && (nFields == 3 || nFields == 4)) {
+            BoardType type = viewToBoardType(fields[1]);
+            int price = viewToPence(fields[2]), meals = nFields == 4 ? viewToInt(fields[3]) : tariff.boardMeals[type];
+            valid = type != NoBoard && price >= 0 && meals >= 0;
+            if (valid) {
+                tariff.boardRates[type] = price;
+                tariff.boardMeals[type] = meals;
+            }
+        } else if (strcmp(kind, "child") == 0 && nFields == 2) {
+            tariff.childPercent = viewToInt(fields[1]);
+            valid = tariff.childPercent >= 0 && tariff.childPercent <= 100;
+        } else if (strcmp(kind, "paper") == 0 && nFields == 2) {
+            tariff.paperRate = viewToPence(fields[1]);
+            valid = tariff.paperRate >= 0;
+        } else if (strcmp(kind, "senior") == 0 && nFields == 3) {
+            tariff.seniorAge = viewToInt(fields[1]);
+            tariff.seniorPercent = viewToInt(fields[2]);
+            valid = tariff.seniorAge > 0 && tariff.seniorPercent >= 0 && tariff.seniorPercent <= 100;
+        }
+        if (!valid) {
+            printf("error: %s:%d: invalid tariff entry\n", filename, lineNum);
+            exit(EXIT_FAILURE);
+        }
+    }
+    fclose(f);
+    if (count == 0) count = highestRoom > nRooms ? highestRoom : nRooms;
+    if (highestRoom > count) {
+        printf("error: %s: room %d is past the %d rooms of the hotel\n", filename, highestRoom, count);
+        exit(EXIT_FAILURE);
+    }
+    for (int room = 1; room <= count; ++room) {
+        if (roomRates[room] == -1) {
+            printf("error: %s: room %d has no price\n", filename, room);
+            exit(EXIT_FAILURE);
+        }
+    }
+    nRooms = count;
+    nRoomWords = (count + 63) / 64;
+    tariff.roomRates = resizeBuffer(roomRates, sizeof(int) * (count + 1));
+}
+
+// Get a guest's age in whole years on a day
+int ageOn(int dob, int day)
+{
+    int birthDay, birthMonth, birthYear, dayOfMonth, month, year;
+    dayToDate(dob, &birthDay, &birthMonth, &birthYear);
+    dayToDate(day, &dayOfMonth, &month, &year);
+    int age = year - birthYear;
+    if (month < birthMonth || (month == birthMonth && dayOfMonth < birthDay)) age--;
+    return age;
+}
+
+// Add a line to an invoice, leaving out lines for nothing
+void addInvoiceLine(Invoice* invoice, const char* item, int quantity, int unitPrice)
+{
+    if (quantity == 0 || unitPrice == 0 || invoice->nLines == MAX_INVOICE_LINES) return;
+    InvoiceLine* line = invoice->lines + invoice->nLines++;
+    line->item = item;
+    line->quantity = quantity;
+    line->unitPrice = unitPrice;
+    line->amount = (int64_t)quantity * unitPrice;
+    invoice->total += line->amount;
+}
+
+// Get the day a booking actually leaves its room when its guest checks out on
+// a day: the booked departure, or the checkout day if that is earlier. A guest
+// checking out on or before their arrival day leaves on their arrival day
+int checkoutDay(const Booking* booking, int day)
+{
+    if (day >= booking->departure) return booking->departure;
+    return day > booking->arrival ? day : booking->arrival;
+}
+
+// Itemise the bill for a booking checking out on a day, given the meals each
+// guest ate or STANDARD_MEALS for the meals their board includes. The room is
+// charged for the nights up to the checkout day and no further, as checking
+// out hands the remaining nights back to be let again. A same-day checkout
+// spends no night in the room, so only its meals and newspaper are charged
+void computeInvoice(const Booking* booking, int nMeals, int day, Invoice* invoice)
+{
+    invoice->nLines = 0;
+    invoice->total = 0;
+    int nights = checkoutDay(booking, day) - booking->arrival;
+    int room = booking->roomNum >= 1 && booking->roomNum <= nRooms ? booking->roomNum : NO_ROOM;
+    BoardType type = booking->boardType;
+    if (nMeals == STANDARD_MEALS) nMeals = nights * tariff.boardMeals[type];
+    addInvoiceLine(invoice, "Room, per night", nights, rates.roomNight[room]);
+    if (booking->dob != NO_DATE && ageOn(booking->dob, day) >= tariff.seniorAge) {
+        addInvoiceLine(invoice, "Senior discount", nights, -rates.seniorDiscount[room]);
+    }
+    invoice->room = invoice->total;
+    addInvoiceLine(invoice, "Board, adult meals", booking->nAdults * nMeals, rates.adultMeal[type]);
+    addInvoiceLine(invoice, "Board, child meals", booking->nChildren * nMeals, rates.childMeal[type]);
+    invoice->board = invoice->total - invoice->room;
+    if (booking->paper == 1) addInvoiceLine(invoice, "Newspaper", 1, tariff.paperRate);
+    invoice->paper = invoice->total - invoice->room - invoice->board;
+}
+
+// Print the lines and total of an invoice
+void printInvoice(const Invoice* invoice)
+{
+    char unitPrice[MONEY_SIZE], amount[MONEY_SIZE];
+    for (int i = 0; i < invoice->nLines; ++i) {
+        const InvoiceLine* line = invoice->lines + i;
+        formatMoney(line->unitPrice, unitPrice);
+        formatMoney(line->amount, amount);
+        printf("%-20s %4d x %8s %10s\n", line->item, line->quantity, unitPrice, amount);
+    }
+    formatMoney(invoice->total, amount);
+    printf("%-20s %25s\n", "Total", amount);
+}
+
+// Write an amount in pence to a buffered writer as pounds and pence
+void writeMoney(OutputBuffer* out, int64_t pence)
+{
+    char money[MONEY_SIZE];
+    formatMoney(pence, money);
+    writeString(out, money);
+}
+
+// Add the bill of a guest checking out to the history of bills, which reports
+// take their revenue and past stays from. Each line holds:
+//   <id>,<room>,<board>,<adults>,<children>,<arrival>,<departure>,<table>,
+//   <time slot>,<table night>,<billed on>,<room>,<board>,<paper>,<total>
+// The departure is the day the guest actually left (see checkoutDay), as the
+// nights after an early checkout may be let to someone else, and a table
+// booked for one of those nights is left out too. Called under the lock on
+// the booking data, and synced like the journal
+void addBill(BookingStore* store, const Booking* booking, const Invoice* invoice, int day)
+{
+    int departure = checkoutDay(booking, day);
+    int tableDay = booking->tableNum > 0 && booking->tableDay < departure ? booking->tableDay : NO_DATE;
+    if (store->bills == NULL) {
+        char filename[FILENAME_MAX];
+        billsFilename(filename, sizeof(filename), store->filename);
+        store->bills = fopen(filename, "a");
+        if (store->bills == NULL) {
+            printf("error: could not open %s\n", filename);
+            exit(EXIT_FAILURE);
+        }
+    }
+    char block[JOURNAL_BLOCK_SIZE];
+    OutputBuffer out;
+    initOutput(&out, store->bills, block, sizeof(block));
+    writeString(&out, booking->id);
+    writeBytes(&out, ",", 1);
+    writeInt(&out, booking->roomNum);
+    writeBytes(&out, ",", 1);
+    writeString(&out, boardCodes[booking->boardType]);
+    writeBytes(&out, ",", 1);
+    writeInt(&out, booking->nAdults);
+    writeBytes(&out, ",", 1);
+    writeInt(&out, booking->nChildren);
+    writeBytes(&out, ",", 1);
+    writeDay(&out, booking->arrival);
+    writeBytes(&out, ",", 1);
+    writeDay(&out, departure);
+    writeBytes(&out, ",", 1);
+    writeInt(&out, tableDay != NO_DATE ? booking->tableNum : 0);
+    writeBytes(&out, ",", 1);
+    writeInt(&out, tableDay != NO_DATE ? booking->tableSlot : 0);
+    writeBytes(&out, ",", 1);
+    writeDay(&out, tableDay);
+    writeBytes(&out, ",", 1);
+    writeDay(&out, day);
+    writeBytes(&out, ",", 1);
+    writeMoney(&out, invoice->room);
+    writeBytes(&out, ",", 1);
+    writeMoney(&out, invoice->board);
+    writeBytes(&out, ",", 1);
+    writeMoney(&out, invoice->paper);
+    writeBytes(&out, ",", 1);
+    writeMoney(&out, invoice->total);
+    writeBytes(&out, "\n", 1);
+    flushOutput(&out);
+    if (store->deferSync) {
+        fflush(store->bills);
+    } else {
+        syncFile(store->bills);
+    }
+}
+
+/* Booking operations shared by the interactive and batch front ends */
+
+// Give a new booking a unique id, allocated from an arena: the last name
+// followed by a unique sequence number. Legacy ids only used a single digit,
+// but are still checked against
+void assignBookingId(BookingStore* store, Booking* booking, Arena* strings)
+{
+    int idSize = strlen(booking->lastName) + 21;
+    booking->id = arenaAlloc(strings, idSize);
+    do {
+        sprintf(booking->id, "%s%ld", booking->lastName, nextBookingSequence(store));
+    } while (findBookingById(store, booking->id) != NO_BOOKING);
+}
+
+// The commit functions below take the advisory lock on the booking data and
+// return 1 once the change is committed. If another process changed the data
+// since the store last caught up, they commit nothing and return 0: the store
+// has caught up by then, and the caller must check its decision against it
+// again before retrying. If another process kept the lock for the whole wait,
+// they commit nothing and return LOCK_BUSY. Callers that already hold the
+// lock, as the batch, import and server modes do, always succeed
+
+// Add a completed booking to the store and make it durable. Its strings are
+// copied into the store's arena once the lock is held, and the booking is
+// pointed at the copies. A booking without an id is given one
+int commitCheckIn(BookingStore* store, Booking* booking)
+{
+    int stale = lockBookingData(store);
+    if (stale == LOCK_BUSY) return LOCK_BUSY;
+    if (!stale) {
+        booking->firstName = arenaString(&store->strings, booking->firstName, strlen(booking->firstName));
+        booking->lastName = arenaString(&store->strings, booking->lastName, strlen(booking->lastName));
+        if (booking->id == NULL) {
+            assignBookingId(store, booking, &store->strings);
+        } else {
+            booking->id = arenaString(&store->strings, booking->id, strlen(booking->id));
+        }
+        addBooking(store, *booking);
+        logAddBooking(store, booking);
+    }
+    unlockBookingData(store);
+    return !stale;
+}
+
+// Remove a booking from the store when its guest checks out on a day, adding
+// their invoice to the history of bills, and make the removal durable
+int commitCheckOut(BookingStore* store, int idx, const Invoice* invoice, int day)
+{
+    int stale = lockBookingData(store);
+    if (stale == LOCK_BUSY) return LOCK_BUSY;
+    if (!stale) {
+        Booking booking;
+        getBooking(store, idx, &booking);
+        addBill(store, &booking, invoice, day);
+        char* bookingId = store->columns.id[idx];
+        removeBooking(store, idx);
+        logRemoveBooking(store, bookingId);
+    }
+    unlockBookingData(store);
+    return !stale;
+}
+
+// Only guests on full or half board eat dinner at the restaurant
+int canBookTable(const BookingStore* store, int idx)
+{
+    return boardIncludesDinner[store->columns.boardType[idx]];
+}
+
+// Get the night a table is booked for when the guest does not choose one:
+// tonight if they are staying, otherwise their first night
+int defaultTableDay(const BookingStore* store, int idx)
+{
+    int today = store->today;
+    if (store->columns.arrival[idx] <= today && today < store->columns.departure[idx]) return today;
+    return store->columns.arrival[idx];
+}
+
+// Check whether a day is one of the nights of a booking's stay
+int nightOfStay(const BookingStore* store, int idx, int day)
+{
+    return day != NO_DATE && store->columns.arrival[idx] <= day && day < store->columns.departure[idx];
+}
+
+// Set or cancel a booking's table reservation and make the change durable
+int commitTable(BookingStore* store, int idx, int table, int timeSlot, int day)
+{
+    int stale = lockBookingData(store);
+    if (stale == LOCK_BUSY) return LOCK_BUSY;
+    if (!stale) {
+        setTable(store, idx, table, timeSlot, day);
+        logTableBooking(store, idx);
+    }
+    unlockBookingData(store);
+    return !stale;
+}
+
+// Tell the clerk that another process is holding the booking data, and ask
+// whether to try saving the change again. Declining drops the change, as does
+// a server holding the data, since it never lets go of it
+int retryCommit(const BookingStore* store)
+{
+    char path[FILENAME_MAX];
+    if (findBookingServer(store->filename, path, sizeof(path))) {
+        printf("The bookings are served by %s; use --connect %s\nNothing was saved.\n", path, path);
+        return 0;
+    }
+    char answer;
+    do {
+        printf("The bookings are in use by another process. Try saving again? (Y/N) ");
+        answer = inputYesNo();
+    } while (answer == 0);
+    if (answer == 'n') printf("Nothing was saved.\n");
+    return answer == 'y';
+}
+
+// Check in function (Orin)
+void checkIn(BookingStore* store)
+{
+    Booking booking = { 0 };
+
+    do {
+        printf("Please enter your first name: ");
+        booking.firstName = trim(inputString());
+    } while (*booking.firstName == '\0' || containsCharsOutside(booking.firstName, &nameClass));
+    booking.firstName = arenaString(&deskStrings, booking.firstName, strlen(booking.firstName));
+
+    do {
+        printf("Please enter you last name: ");
+        booking.lastName = trim(inputString());
+    } while (*booking.lastName == '\0' || containsCharsOutside(booking.lastName, &nameClass));
+    booking.lastName = arenaString(&deskStrings, booking.lastName, strlen(booking.lastName));
+
+    printf("\n");
+    char* dobString;
+    do {
+        printf("Please enter your date of birth (DD/MM/YYYY): ");
+        dobString = trim(inputString());
+    } while (!validDOB(dobString));
+    booking.dob = parseDate(dobString);
+
+    assignBookingId(store, &booking, &deskStrings);
+    printf("\nHere is your booking id: %s\n", booking.id);
+
+    printf("\nAvailable board types:\n--------------------\n");
+    for (int type = FullBoard; type < N_BOARD_TYPES; ++type) {
+        char label[32];
+        snprintf(label, sizeof(label), "%s (%s)", boardNames[type], boardCodes[type]);
+        char price[MONEY_SIZE];
+        formatMoney(tariff.boardRates[type], price);
+        printf("%d: %-21s | £%s per person, per meal\n", type, label, price);
+    }
+    int choice = 0;
+    do {
+        printf("Select a board type (1-3): ");
+        choice = inputInt();
+    } while (choice > 3 || choice < 1);
+    booking.boardType = choice;
+    printf("\n");
+
+    do {
+        printf("How many days are you staying for? ");
+        booking.nDays = inputInt();
+    } while (booking.nDays < 1 || booking.nDays > MAX_DAYS);
+
+    booking.arrival = NO_DATE;
+    while (booking.arrival == NO_DATE) {
+        printf("What day are you arriving? (DD/MM/YYYY, leave blank for today): ");
+        char* date = trim(inputString());
+        StringView view = { date, strlen(date) };
+        booking.arrival = *date == '\0' ? store->today : viewToDay(view);
+        if (booking.arrival != NO_DATE && booking.arrival < store->today) {
+            printf("Your arrival date cannot be in the past.\n");
+            booking.arrival = NO_DATE;
+        }
+    }
+    booking.departure = booking.arrival + booking.nDays;
+    printf("__________________________\n");
+
+    while (booking.nAdults < 0 || booking.nChildren < 0
+           || (booking.nAdults + booking.nChildren) > 4 || (booking.nAdults + booking.nChildren) == 0)
+    {
+        do {
+            printf("How many adults are staying? ");
+            booking.nAdults = inputInt();
+        } while (booking.nAdults < 0);
+
+        do {
+            printf("How many children are staying? (age 16 or below): ");
+            booking.nChildren = inputInt();
+        } while (booking.nChildren < 0);
+        if((booking.nChildren + booking.nAdults) > 4)
+        {
+            printf("Sorry that is too many people in one room\n__________________________\n");
+
+
+        }
+    }
+
+    printf("__________________________\n");
+
+    do {
+        printf("Would you like a daily newspaper? (1 for yes or 0 for no): ");
+        booking.paper = inputInt();
+    } while (booking.paper != 1 && booking.paper != 0);
+    printf("__________________________\n");
+
+    uint64_t available[MAX_ROOM_WORDS];
+    freeRoomsBetween(store, booking.arrival, booking.departure, ANY_PRICE, available);
+    if (countRooms(available) == 0)
+    {
+        printf("Sorry the hotel is full for those dates\n");
+        return;
+    }
+
+    int selectedRoom = 0;
+    int roomChoice = 0;
+    while (!selectedRoom) 
+    {
+        printf("Rooms available:\n---------------\n");
+        for (int room = nextRoom(available, 0); room != NO_ROOM; room = nextRoom(available, room)) {
+            char price[MONEY_SIZE];
+            formatMoney(tariff.roomRates[room], price);
+            printf("Room %d: £%s per night\n", room, price);
+        }
+        
+        selectedRoom = 1;
+        printf("What room would you like 1-%d: \n", nRooms);
+        roomChoice = inputInt();
+
+
+        while(roomChoice < 1 || roomChoice > nRooms)
+        {
+            printf("Please enter a valid room number...\n");
+            roomChoice = inputInt();
+        }
+
+        if (roomFreeBetween(store, roomChoice, booking.arrival, booking.departure))
+        {
+            printf("You have booked room %d\n__________________________\n", roomChoice);
+        }
+
+        else 
+        {
+            printf("The room you selected is unavailable, please select a different one.\n");
+            selectedRoom = 0;
+        }
+    
+    }
+    booking.roomNum = roomChoice;
+
+    // Another desk may have changed the bookings while this one was filled in
+    int committed;
+    while ((committed = commitCheckIn(store, &booking)) != 1) {
+        if (committed == LOCK_BUSY) {
+            if (!retryCommit(store)) return;
+        } else if (!roomFreeBetween(store, booking.roomNum, booking.arrival, booking.departure)) {
+            printf("Sorry, room %d has just been booked from another desk.\n", booking.roomNum);
+            return;
+        }
+    }
+}
+
+void checkOut(BookingStore* store)
+{
+    // Booking ID
+    int roomnum = -1;
+    printf("Enter your booking ID: ");
+    char* bokid = inputString();
+    roomnum = findBookingById(store, bokid);
+    if (roomnum == NO_BOOKING){
+        printf("Invalid booking ID\n");
+        return;
+    }
+    // The input buffer is about to be reused for the number of meals
+    bokid = arenaString(&deskStrings, bokid, strlen(bokid));
+    int nMeals = -1;
+    do {
+        printf("How many meals have you had? ");
+        nMeals = inputInt();
+    } while (nMeals < 0);
+
+    int billDay, billMonth, billYear;
+    dayToDate(currentDay(), &billDay, &billMonth, &billYear);
+
+    printf("==========================\n");
+    printf("Thank you for staying at\nThe Kashyyyk Hotel\n");
+    printf("==========================\n");
+    printf("Date of bill: %d.%d.%d\n", billDay, billMonth, billYear);
+    printf("Booking ID: %s\n", bokid);
+    Booking booking;
+    getBooking(store, roomnum, &booking);
+    printf("Main user: %s %s\n", booking.firstName, booking.lastName);
+    printf("number of adults: %d\n",booking.nAdults);
+    printf("number of children: %d\n",booking.nChildren);
+    printf("Room stayed in: %d\n",booking.roomNum);
+    printf("--------------------------\n");
+
+    Invoice invoice;
+    computeInvoice(&booking, nMeals, currentDay(), &invoice);
+    printInvoice(&invoice);
+    printf("==========================\n");
+
+    int committed;
+    while ((committed = commitCheckOut(store, roomnum, &invoice, currentDay())) != 1) {
+        if (committed == LOCK_BUSY) {
+            if (!retryCommit(store)) return;
+            continue;
+        }
+        roomnum = findBookingById(store, bokid);
+        if (roomnum == NO_BOOKING) {
+            printf("This booking has already been checked out from another desk.\n");
+            return;
+        }
+    }
+    printf("Thank you for staying at The Kashyyyk Hotel\n");
+}
+
+// Table booking function (Tom)
+void bookTable(BookingStore* store)
+{
+    const int* tableNums = store->columns.tableNum;
+    const int* tableSlots = store->columns.tableSlot;
+    // Check booking ID
+    print(500, "In order to book a table, please enter your booking ID: ");
+    // The id is read again if another desk changes the bookings, but the
+    // input buffer is reused by the next prompt
+    char* bookingId = inputString();
+    bookingId = arenaString(&deskStrings, bookingId, strlen(bookingId));
+    int bookingIdx = findBookingById(store, bookingId);
+    if (bookingIdx == NO_BOOKING) {
+        print(500, "Sorry, that is an invalid booking ID, you cannot book a table.\n");
+        return;
+    } else if (!canBookTable(store, bookingIdx)) {
+        print(500, "Sorry, you are booked in for Bed & Breakfast, meaning you cannot book a dinner table.\n");
+        return;
+    } else if ((tableNums[bookingIdx] != TABLE_UNAVAILABLE && tableNums[bookingIdx] != INVALID_TABLE_ENTRY) ||
+               (tableSlots[bookingIdx] != TABLE_UNAVAILABLE && tableSlots[bookingIdx] != INVALID_TABLE_ENTRY)) {
+        char date[11], slotTime[TIME_SIZE];
+        formatDay(store->columns.tableDay[bookingIdx], date);
+        formatTimeSlot(tableSlots[bookingIdx], slotTime);
+        print(
+                500,
+                "You currently have a table booked: %s at %s on %s\n",
+                getTableName(tableNums[bookingIdx]),
+                slotTime,
+                date
+        );
+        char choice;
+        do {
+            print(200, "Would you like to cancel your table booking? (Y/N) ");
+            choice = inputYesNo();
+        } while (choice == 0);
+        if (choice == 'y') {
+            int committed;
+            while ((committed = commitTable(store, bookingIdx, INVALID_TABLE_ENTRY, INVALID_TABLE_ENTRY, NO_DATE)) != 1) {
+                if (committed == LOCK_BUSY) {
+                    if (!retryCommit(store)) return;
+                    continue;
+                }
+                bookingIdx = findBookingById(store, bookingId);
+                if (bookingIdx == NO_BOOKING) return;
+            }
+        }
+        return;
+    }
+
+    // Choose one of the nights of the stay
+    char defaultDate[11];
+    formatDay(defaultTableDay(store, bookingIdx), defaultDate);
+    int day = NO_DATE;
+    while (day == NO_DATE) {
+        print(200, "Which night would you like a table for? (DD/MM/YYYY, leave blank for %s): ", defaultDate);
+        char* date = trim(inputString());
+        day = *date == '\0' ? defaultTableDay(store, bookingIdx) : parseDate(date);
+        if (!nightOfStay(store, bookingIdx, day)) {
+            printf("That is not one of the nights of your stay.\n");
+            day = NO_DATE;
+        }
+    }
+
+    // Create a 2D array of the tables still free at each time slot that night
+    int tablesAvailable[MAX_TIMESLOTS][MAX_TABLES];
+    int nAvailable = 0;
+    for (int i = 0; i < nTimeSlots; ++i) {
+        for (int j = 0; j < nTables; ++j) {
+            int isFree = tableAvailable(store, day, j + 1, timeSlots[i]);
+            tablesAvailable[i][j] = isFree ? j + 1 : TABLE_UNAVAILABLE;
+            nAvailable += isFree;
+        }
+    }
+    if (nAvailable == 0) {
+        print(500, "Sorry, every table is booked that night.\n");
+        return;
+    }
+    int confirmChoice = 0;
+    while (!confirmChoice) {
+        // Display available tables
+        print(200, "Available tables: \n-----------------\n");
+        int idx = 0, newIdx = 0, tableChoice;
+        for (int i = 0; i < nTimeSlots; ++i) {
+            for (int j = 0; j < nTables; ++j) {
+                if (tablesAvailable[i][j] == TABLE_UNAVAILABLE) continue;
+                char slotTime[TIME_SIZE];
+                formatTimeSlot(timeSlots[i], slotTime);
+                print(100, "%d: %-*s | %s | Serves 4\n", idx + 1, tableNameWidth(), getTableName(tablesAvailable[i][j]), slotTime);
+                idx++;
+            }
+        }
+        printf("\n");
+        do {
+            print(200, "Please select the table you want (1-%d): ", idx);
+            tableChoice = inputInt();
+        } while (1 > tableChoice || tableChoice > idx);
+
+        int tempTableNum = 0, tempTableSlot = 0;
+        for (int i = 0; i < nTimeSlots; ++i) {
+            for (int j = 0; j < nTables; ++j) {
+                if (tablesAvailable[i][j] == TABLE_UNAVAILABLE) continue;
+                if (tableChoice == newIdx + 1) {
+                    tempTableNum = tablesAvailable[i][j];
+                    tempTableSlot = timeSlots[i];
+                }
+                newIdx++;
+            }
+        }
+        char slotTime[TIME_SIZE];
+        formatTimeSlot(tempTableSlot, slotTime);
+        printf(
+                "You have selected: %s at %s\n",
+                getTableName(tempTableNum),
+                slotTime
+        );
+        char choice;
+        do {
+            print(200, "Would you like to confirm your booking? (Y/N) ");
+            choice = inputYesNo();
+        } while (choice == 0);
+        if (choice == 'y') {
+            int committed;
+            while ((committed = commitTable(store, bookingIdx, tempTableNum, tempTableSlot, day)) != 1) {
+                if (committed == LOCK_BUSY) {
+                    if (!retryCommit(store)) return;
+                    continue;
+                }
+                bookingIdx = findBookingById(store, bookingId);
+                if (bookingIdx == NO_BOOKING || store->columns.tableNum[bookingIdx] > 0
+                    || !tableAvailable(store, day, tempTableNum, tempTableSlot)) {
+                    print(500, "Sorry, that table has just been booked from another desk.\n");
+                    return;
+                }
+            }
+            confirmChoice = 1;
+        }
+    }
+    char date[11], slotTime[TIME_SIZE];
+    formatDay(day, date);
+    formatTimeSlot(store->columns.tableSlot[bookingIdx], slotTime);
+    print(
+            500,
+            "Successfully booked a table for %s at %s on %s\n",
+            getTableName(store->columns.tableNum[bookingIdx]),
+            slotTime,
+            date
+    );
+}
+
+/* Batch mode */
+
+// Read the whole of a stream into a NUL-terminated buffer, which is kept for
+// the rest of the session as bookings created from it point into it
+char* readStream(FILE* f, size_t* size)
+{
+    size_t capacity = OUTPUT_BUFFER_SIZE, n = 0;
+    char* data = resizeBuffer(NULL, capacity + 1);
+    while ((n = fread(data + *size, 1, capacity - *size, f)) > 0) {
+        *size += n;
+        if (*size == capacity) {
+            capacity *= 2;
+            data = resizeBuffer(data, capacity + 1);
+        }
+    }
+    data[*size] = '\0';
+    return data;
+}
+
+// Split a NUL-terminated list of comma separated fields in place, returning
+// the number of fields found
+int splitFields(char* str, StringView* fields, int maxFields)
+{
+    char* end = str + strlen(str);
+    char delim = ',';
+    int nFields = 0;
+    while (delim == ',' && nFields < maxFields) {
+        str = nextField(str, end, fields + nFields, &delim);
+        nFields++;
+    }
+    return nFields;
+}
+
+// Validate the fields of a reservation as given to the checkin command,
+// filling in the booking. A room of 0 leaves the choice of room to the caller.
+// Returns NULL or an error. Does not print or touch the store, so rows can be
+// checked on several threads at once
+const char* parseCheckIn(StringView* fields, int nFields, int today, Booking* booking)
+{
+    if (nFields != 9 && nFields != 10) return "expected 9 or 10 fields";
+    for (int i = 0; i < nFields; ++i) {
+        fields[i].ptr = trim(fields[i].ptr);
+        fields[i].len = strlen(fields[i].ptr);
+    }
+    memset(booking, 0, sizeof(Booking));
+    booking->firstName = fields[0].ptr;
+    booking->lastName = fields[1].ptr;
+    if (fields[0].len == 0 || booking->firstName[spanCharClass(&nameClass, booking->firstName)] != '\0') return "invalid first name";
+    if (fields[1].len == 0 || booking->lastName[spanCharClass(&nameClass, booking->lastName)] != '\0') return "invalid last name";
+    // A well-formed date is rejected with the reason the desk would give
+    const char* error = dobError(fields[2].ptr, today);
+    if (error != NULL) return *error != '\0' ? error : "invalid date of birth";
+    booking->dob = viewToDay(fields[2]);
+    booking->boardType = viewToBoardType(fields[3]);
+    if (booking->boardType == NoBoard) return "board type must be FB, HB or BB";
+    booking->nDays = viewToInt(fields[4]);
+    booking->nAdults = viewToInt(fields[5]);
+    booking->nChildren = viewToInt(fields[6]);
+    booking->paper = viewToInt(fields[7]);
+    booking->roomNum = viewToInt(fields[8]);
+    booking->tableNum = TABLE_UNAVAILABLE;
+    booking->tableSlot = TABLE_UNAVAILABLE;
+    if (booking->nDays < 1 || booking->nDays > MAX_DAYS) return "invalid number of days";
+    booking->arrival = nFields == 10 ? viewToDay(fields[9]) : today;
+    if (booking->arrival == NO_DATE || booking->arrival < today) return "invalid arrival date";
+    booking->departure = booking->arrival + booking->nDays;
+    if (booking->nAdults < 0 || booking->nChildren < 0 || booking->nAdults + booking->nChildren == 0
+        || booking->nAdults + booking->nChildren > 4) return "a room holds between 1 and 4 guests";
+    if (booking->paper != 0 && booking->paper != 1) return "paper must be 0 or 1";
+    if (booking->roomNum < 0 || booking->roomNum > nRooms) return "invalid room number";
+    return NULL;
+}
+
+// Give a booking the lowest numbered room free for its stay if it has no room
+// yet, or check that its room is free. Returns 0 if there is no room for it
+int assignRoom(const BookingStore* store, Booking* booking)
+{
+    if (booking->roomNum != NO_ROOM) {
+        return roomFreeBetween(store, booking->roomNum, booking->arrival, booking->departure);
+    }
+    uint64_t rooms[MAX_ROOM_WORDS];
+    freeRoomsBetween(store, booking->arrival, booking->departure, ANY_PRICE, rooms);
+    booking->roomNum = nextRoom(rooms, 0);
+    return booking->roomNum != NO_ROOM;
+}
+
+// What the front desk is told about a booking looked up by its id
+typedef struct {
+    const char* id;
+    int roomNum, arrival, departure, tableNum, tableSlot, tableDay;
+} BookingSummary;
+
+// Fill in the summary of the booking in a slot
+void summarizeBooking(const BookingStore* store, int idx, BookingSummary* summary)
+{
+    summary->id = store->columns.id[idx];
+    summary->roomNum = store->columns.roomNum[idx];
+    summary->arrival = store->columns.arrival[idx];
+    summary->departure = store->columns.departure[idx];
+    summary->tableNum = store->columns.tableNum[idx];
+    summary->tableSlot = store->columns.tableSlot[idx];
+    summary->tableDay = store->columns.tableDay[idx];
+}
+
+// Format a booking summary as the result of the booking command
+void formatBookingSummary(const BookingSummary* summary, char* result)
+{
+    char arrival[11], departure[11], tableDay[11], slotTime[TIME_SIZE];
+    formatDay(summary->arrival, arrival);
+    formatDay(summary->departure, departure);
+    int n = snprintf(result, BATCH_RESULT_SIZE, "room %d from %s to %s", summary->roomNum, arrival, departure);
+    if (summary->tableNum > 0 && summary->tableDay != NO_DATE && n < BATCH_RESULT_SIZE) {
+        formatDay(summary->tableDay, tableDay);
+        formatTimeSlot(summary->tableSlot, slotTime);
+        snprintf(result + n, BATCH_RESULT_SIZE - n, ", %s at %s on %s", getTableName(summary->tableNum), slotTime, tableDay);
+    }
+}
+
+// Format the tables free on a night as the result of the tables command
+void formatFreeTables(const DiningGrid* grid, int day, char* result)
+{
+    int firstTable, firstSlot;
+    int count = countFreeTables(grid, day, &firstTable, &firstSlot);
+    if (count == 0) {
+        snprintf(result, BATCH_RESULT_SIZE, "0 free");
+    } else {
+        char slotTime[TIME_SIZE];
+        formatTimeSlot(firstSlot, slotTime);
+        snprintf(result, BATCH_RESULT_SIZE, "%d free, first %s at %s", count, getTableName(firstTable), slotTime);
+    }
+}
+
+// checkin <first name>,<last name>,<dob>,<FB|HB|BB>,<days>,<adults>,<children>,<paper 0|1>,<room or 0 for any>[,<arrival>]
+const char* batchCheckIn(BookingStore* store, StringView* fields, int nFields, char* result)
+{
+    Booking booking;
+    const char* error = parseCheckIn(fields, nFields, store->today, &booking);
+    if (error != NULL) return error;
+    if (!assignRoom(store, &booking)) return "room is unavailable";
+    // The names point into the script, which is freed when the run ends, and
+    // are copied into the store as the booking is committed
+    commitCheckIn(store, &booking);
+    snprintf(result, BATCH_RESULT_SIZE, "%s room %d", booking.id, booking.roomNum);
+    return NULL;
+}
+
+// checkout <booking id>,<meals>
+const char* batchCheckOut(BookingStore* store, StringView* fields, int nFields, char* result)
+{
+    if (nFields != 2) return "checkout expects 2 fields";
+    int idx = findBookingById(store, fields[0].ptr);
+    if (idx == NO_BOOKING) return "invalid booking id";
+    int nMeals = viewToInt(fields[1]);
+    if (nMeals < 0) return "invalid number of meals";
+    Booking booking;
+    getBooking(store, idx, &booking);
+    Invoice invoice;
+    computeInvoice(&booking, nMeals, currentDay(), &invoice);
+    commitCheckOut(store, idx, &invoice, currentDay());
+    formatMoney(invoice.total, result);
+    return NULL;
+}
+
+// Format a table booking as the result of a table command
+void formatTableBooking(int table, int timeSlot, int day, char* result)
+{
+    char date[11], slotTime[TIME_SIZE];
+    formatTimeSlot(timeSlot, slotTime);
+    int n = snprintf(result, BATCH_RESULT_SIZE, "%s at %s", getTableName(table), slotTime);
+    // Tables booked before nights were recorded have no night
+    if (day != NO_DATE && n < BATCH_RESULT_SIZE) {
+        formatDay(day, date);
+        snprintf(result + n, BATCH_RESULT_SIZE - n, " on %s", date);
+    }
+}
+
+// booktable <booking id>,<table>,<time slot>[,<night>]
+const char* batchBookTable(BookingStore* store, StringView* fields, int nFields, char* result)
+{
+    if (nFields != 3 && nFields != 4) return "booktable expects 3 or 4 fields";
+    int idx = findBookingById(store, fields[0].ptr);
+    if (idx == NO_BOOKING) return "invalid booking id";
+    if (!canBookTable(store, idx)) return "bed & breakfast guests cannot book a table";
+    if (store->columns.tableNum[idx] > 0) return "a table is already booked";
+    int table = viewToInt(fields[1]), timeSlot = viewToInt(fields[2]);
+    if (table < 1 || table > nTables || timeSlotIndex(timeSlot) == -1) return "invalid table or time slot";
+    int day = nFields == 4 ? viewToDay(fields[3]) : defaultTableDay(store, idx);
+    if (!nightOfStay(store, idx, day)) return "not a night of the stay";
+    if (!tableAvailable(store, day, table, timeSlot)) return "table is unavailable";
+    commitTable(store, idx, table, timeSlot, day);
+    formatTableBooking(table, timeSlot, day, result);
+    return NULL;
+}
+
+// canceltable <booking id>
+const char* batchCancelTable(BookingStore* store, StringView* fields, int nFields, char* result)
+{
+    if (nFields != 1) return "canceltable expects 1 field";
+    int idx = findBookingById(store, fields[0].ptr);
+    if (idx == NO_BOOKING) return "invalid booking id";
+    if (store->columns.tableNum[idx] <= 0) return "no table is booked";
+    // The reply names the table that was given up
+    formatTableBooking(store->columns.tableNum[idx], store->columns.tableSlot[idx], store->columns.tableDay[idx], result);
+    commitTable(store, idx, INVALID_TABLE_ENTRY, INVALID_TABLE_ENTRY, NO_DATE);
+    return NULL;
+}
+
+// rooms [<max price>]
+const char* batchRooms(BookingStore* store, StringView* fields, int nFields, char* result)
+{
+    if (nFields > 1) return "rooms expects at most 1 field";
+    int maxPrice = nFields == 1 ? viewToInt(fields[0]) : ANY_PRICE;
+    snprintf(result, BATCH_RESULT_SIZE, "%d free, first %d", countFreeRooms(store, maxPrice), firstFreeRoom(store, maxPrice));
+    return NULL;
+}
+
+// free <from>,<to>[,<max price>]
+const char* batchFreeRooms(BookingStore* store, StringView* fields, int nFields, char* result)
+{
+    if (nFields != 2 && nFields != 3) return "free expects 2 or 3 fields";
+    int from = viewToDay(fields[0]), to = viewToDay(fields[1]);
+    if (from == NO_DATE || to == NO_DATE || to <= from) return "invalid date range";
+    uint64_t rooms[MAX_ROOM_WORDS];
+    freeRoomsBetween(store, from, to, nFields == 3 ? viewToInt(fields[2]) : ANY_PRICE, rooms);
+    snprintf(result, BATCH_RESULT_SIZE, "%d free, first %d", countRooms(rooms), nextRoom(rooms, 0));
+    return NULL;
+}
+
+// booking <booking id>
+const char* batchFind(BookingStore* store, StringView* fields, int nFields, char* result)
+{
+    if (nFields != 1) return "booking expects 1 field";
+    int idx = findBookingById(store, fields[0].ptr);
+    if (idx == NO_BOOKING) return "invalid booking id";
+    BookingSummary summary;
+    summarizeBooking(store, idx, &summary);
+    formatBookingSummary(&summary, result);
+    return NULL;
+}
+
+// tables [<night>]
+const char* batchTables(BookingStore* store, StringView* fields, int nFields, char* result)
+{
+    if (nFields > 1) return "tables expects at most 1 field";
+    int day = nFields == 1 ? viewToDay(fields[0]) : store->today;
+    if (day == NO_DATE) return "invalid date";
+    formatFreeTables(&store->dining, day, result);
+    return NULL;
+}
+
+// today <DD/MM/YYYY|clock>
+// Pins the date seen by the following commands, so that a replayed script
+// gives the same results whenever it is run
+const char* batchToday(BookingStore* store, StringView* fields, int nFields, char* result)
+{
+    if (nFields != 1) return "today expects 1 field";
+    int day = strcmp(fields[0].ptr, "clock") == 0 ? NO_DATE : viewToDay(fields[0]);
+    if (day == NO_DATE && strcmp(fields[0].ptr, "clock") != 0) return "invalid date";
+    setCurrentDay(day);
+    refreshOccupancy(store);
+    formatDay(store->today, result);
+    return NULL;
+}
+
+// Run booking operations from a script ("-" for stdin) with no prompts and no
+// delays. Each line holds a command and its comma separated fields, and one
+// result line is printed per command. Journal records are synced to disk once
+// at the end rather than per command. Returns the number of failed commands
+int runBatch(BookingStore* store, const char* filename)
+{
+    FILE* f = strcmp(filename, "-") == 0 ? stdin : fopen(filename, "r");
+    if (f == NULL) {
+        printf("error: could not open %s\n", filename);
+        exit(EXIT_FAILURE);
+    }
+    size_t size = 0;
+    char* data = readStream(f, &size);
+    if (f != stdin) fclose(f);
+
+    StringView fields[16];
+    char result[BATCH_RESULT_SIZE];
+    int lineNum = 0, nCommands = 0, nFailed = 0;
+    double start = wallSeconds();
+    // The script runs under the lock on the booking data, so its commands see
+    // current data and never have to be retried. Every chunk of commands it
+    // hands the lock to a desk that is waiting for it
+    waitForBookingData(store);
+    refreshOccupancy(store);
+    store->deferSync = 1;
+    char* cursor = data;
+    while (cursor < data + size) {
+        char* line = cursor;
+        char* lineEnd = strchr(line, '\n');
+        if (lineEnd == NULL) lineEnd = data + size;
+        cursor = lineEnd + 1;
+        *lineEnd = '\0';
+        lineNum++;
+        line = trim(line);
+        if (*line == '\0' || *line == '#') continue;
+        if (nCommands > 0 && nCommands % BATCH_CHUNK_COMMANDS == 0) yieldBookingData(store);
+
+        char* args = strchr(line, ' ');
+        if (args != NULL) *args++ = '\0';
+        int nFields = args != NULL ? splitFields(trim(args), fields, 16) : 0;
+        const char* error = "unknown command";
+        *result = '\0';
+        refreshOccupancy(store);
+        if (strcmp(line, "checkin") == 0) error = batchCheckIn(store, fields, nFields, result);
+        else if (strcmp(line, "checkout") == 0) error = batchCheckOut(store, fields, nFields, result);
+        else if (strcmp(line, "booktable") == 0) error = batchBookTable(store, fields, nFields, result);
+        else if (strcmp(line, "canceltable") == 0) error = batchCancelTable(store, fields, nFields, result);
+        else if (strcmp(line, "rooms") == 0) error = batchRooms(store, fields, nFields, result);
+        else if (strcmp(line, "free") == 0) error = batchFreeRooms(store, fields, nFields, result);
+        else if (strcmp(line, "tables") == 0) error = batchTables(store, fields, nFields, result);
+        else if (strcmp(line, "booking") == 0) error = batchFind(store, fields, nFields, result);
+        else if (strcmp(line, "today") == 0) error = batchToday(store, fields, nFields, result);
+        if (error != NULL) {
+            printf("%d: error: %s\n", lineNum, error);
+            nFailed++;
+        } else {
+            printf("%d: ok%s%s\n", lineNum, *result ? " " : "", result);
+        }
+        nCommands++;
+    }
+    syncFile(store->journal);
+    if (store->bills != NULL) syncFile(store->bills);
+    store->deferSync = 0;
+    unlockBookingData(store);
+    free(data);
+    double seconds = wallSeconds() - start;
+    printf("%d commands, %d failed, in %.3fs", nCommands, nFailed, seconds);
+    if (seconds > 0) printf(" (%.0f per second)", nCommands / seconds);
+    printf("\n");
+    return nFailed;
+}
+
+/* Bulk import */
+
+// A row of an import file and the outcome of checking it
+typedef struct {
+    char* line;
+    int lineNum;
+    Booking booking;
+    const char* error;
+} ImportRow;
+
+// Rows of an import file being checked, with the date they are checked
+// against
+typedef struct {
+    ImportRow* rows;
+    int today;
+} ImportCheck;
+
+// Check a chunk of the rows of an import file. Rows are independent, so the
+// chunks can be checked on several threads at once, and which chunk this is
+// does not matter
+void checkImportRows(void* context, int chunk, int begin, int end)
+{
+    (void)chunk;
+    ImportCheck* check = context;
+    for (int i = begin; i < end; ++i) {
+        StringView fields[16];
+        ImportRow* row = check->rows + i;
+        int nFields = splitFields(row->line, fields, 16);
+        row->error = parseCheckIn(fields, nFields, check->today, &row->booking);
+    }
+}
+
+// Import reservations from a CSV file ("-" for stdin) exported by the channel
+// manager. Each row holds the fields of the batch checkin command, with a
+// room of 0 to have one assigned. Rows are validated in parallel on the
+// parallelFor threads, then given rooms and ids in file order and written out in a
+// single save. Rejected rows are reported and leave the store untouched.
+// Returns the number of rejected rows
+int importBookings(BookingStore* store, const char* filename)
+{
+    FILE* f = strcmp(filename, "-") == 0 ? stdin : fopen(filename, "r");
+    if (f == NULL) {
+        printf("error: could not open %s\n", filename);
+        exit(EXIT_FAILURE);
+    }
+    double start = wallSeconds();
+    size_t size = 0;
+    char* data = readStream(f, &size);
+    if (f != stdin) fclose(f);
+
+    // Split the rows serially, then check them independently
+    int nRows = 0, capacity = STORE_INITIAL_CAPACITY, lineNum = 0;
+    ImportRow* rows = resizeBuffer(NULL, sizeof(ImportRow) * capacity);
+    char* cursor = data;
+    while (cursor < data + size) {
+        char* line = cursor;
+        char* lineEnd = memchr(line, '\n', data + size - line);
+        if (lineEnd == NULL) lineEnd = data + size;
+        cursor = lineEnd + 1;
+        *lineEnd = '\0';
+        lineNum++;
+        line = trim(line);
+        if (*line == '\0' || *line == '#') continue;
+        if (nRows == capacity) {
+            capacity *= 2;
+            rows = resizeBuffer(rows, sizeof(ImportRow) * capacity);
+        }
+        rows[nRows].line = line;
+        rows[nRows].lineNum = lineNum;
+        nRows++;
+    }
+    ImportCheck check = { rows, store->today };
+    parallelFor(nRows, loopChunks(nRows), checkImportRows, &check);
+    int nValid = 0;
+    for (int i = 0; i < nRows; ++i) nValid += rows[i].error == NULL;
+
+    // Rooms and ids depend on the rows before, so they are given out in order,
+    // holding the lock on the booking data until the rows are saved
+    waitForBookingData(store);
+    long sequence = nValid > 0 ? reserveBookingSequences(store, nValid) : 0;
+    int nImported = 0;
+    for (int i = 0; i < nRows; ++i) {
+        ImportRow* row = rows + i;
+        if (row->error == NULL && !assignRoom(store, &row->booking)) row->error = "room is unavailable";
+        if (row->error != NULL) {
+            printf("%d: rejected: %s\n", row->lineNum, row->error);
+            continue;
+        }
+        // Only the accepted rows' strings are kept, so the file can be freed
+        Booking* booking = &row->booking;
+        booking->firstName = arenaString(&store->strings, booking->firstName, strlen(booking->firstName));
+        booking->lastName = arenaString(&store->strings, booking->lastName, strlen(booking->lastName));
+        booking->id = arenaAlloc(&store->strings, strlen(booking->lastName) + 21);
+        sprintf(booking->id, "%s%ld", booking->lastName, sequence++);
+        if (findBookingById(store, booking->id) != NO_BOOKING) assignBookingId(store, booking, &store->strings);
+        addBooking(store, *booking);
+        nImported++;
+    }
+    free(rows);
+    free(data);
+    if (nImported > 0) compactBookingData(store);
+    unlockBookingData(store);
+    double seconds = wallSeconds() - start;
+    printf("%d of %d rows imported, %d rejected, in %.3fs\n", nImported, nRows, nRows - nImported, seconds);
+    return nRows - nImported;
+}
+
+// Check out and bill every guest leaving on a day, charging the meals their
+// board includes. Prints each invoice and returns the number of guests billed
+int billDepartures(BookingStore* store, int day)
+{
+    double start = wallSeconds();
+    waitForBookingData(store);
+    store->deferSync = 1;
+    int nBilled = 0;
+    int64_t total = 0;
+    // Removing a booking moves the last one into its place, so walking down
+    // from the end visits every booking once
+    for (int idx = store->nBookings - 1; idx >= 0; --idx) {
+        if (store->columns.departure[idx] != day) continue;
+        Booking booking;
+        getBooking(store, idx, &booking);
+        Invoice invoice;
+        computeInvoice(&booking, STANDARD_MEALS, day, &invoice);
+        printf("%s: %s %s, room %d\n", booking.id, booking.firstName, booking.lastName, booking.roomNum);
+        printInvoice(&invoice);
+        printf("\n");
+        total += invoice.total;
+        addBill(store, &booking, &invoice, day);
+        removeBooking(store, idx);
+        nBilled++;
+    }
+    // The bills must be on disk before the compaction drops the bookings
+    if (store->bills != NULL) syncFile(store->bills);
+    store->deferSync = 0;
+    if (nBilled > 0) compactBookingData(store);
+    unlockBookingData(store);
+    char money[MONEY_SIZE];
+    formatMoney(total, money);
+    printf("%d guests billed, total %s, in %.3fs\n", nBilled, money, wallSeconds() - start);
+    return nBilled;
+}
+
+/* Reports */
+
+// The stay of a guest that checked out, as recorded in the history of bills
+typedef struct {
+    int roomNum, nAdults, nChildren, arrival, departure;
+    int tableNum, tableSlot, tableDay, billDay;
+    BoardType boardType;
+    int64_t room, board, paper;
+} Bill;
+
+// Totals over the stays overlapping a period of nights [first, end), both of
+// the bookings in the store and of the guests that already checked out.
+// Stays are counted for the nights they spend in the period. Revenue comes
+// from the history of bills, as charged at checkout, and counts in the period
+// its bill was made in: a bill made on the morning after the period's last
+// night still counts. Stays without dates are left out
+typedef struct {
+    int first, end;
+    // Nights actually covered by stays, for reports over every stay
+    int firstNight, endNight;
+    int64_t nStays, nAdults, nChildren, guestNights, nBilled;
+    // Indexed by room number, with the revenue of rooms the hotel no longer
+    // has counted against NO_ROOM
+    int64_t *roomNights, *roomRevenue;
+    int64_t boardRevenue[N_BOARD_TYPES];
+    int64_t paperRevenue;
+    int64_t tableNights[MAX_TIMESLOTS][MAX_TABLES + 1];
+} Report;
+
+// Read the history of bills that belongs to a booking file into an array,
+// returning the number of bills. A missing history has none, and a last line
+// that was only partly written is left out
+Bill* loadBills(const char* filename, int* nBills)
+{
+    char billsFile[FILENAME_MAX];
+    billsFilename(billsFile, sizeof(billsFile), filename);
+    *nBills = 0;
+    FILE* f = fopen(billsFile, "r");
+    if (f == NULL) return NULL;
+    size_t size = 0;
+    char* data = readStream(f, &size);
+    fclose(f);
+    int capacity = 0, lineNum = 0;
+    Bill* bills = NULL;
+    char* cursor = data;
+    while (cursor < data + size) {
+        char* line = cursor;
+        char* lineEnd = strchr(line, '\n');
+        if (lineEnd == NULL) break;
+        cursor = lineEnd + 1;
+        *lineEnd = '\0';
+        lineNum++;
+        StringView fields[15];
+        if (*line == '\0' || splitFields(line, fields, 15) != 15) {
+            printf("error: %s:%d: invalid bill\n", billsFile, lineNum);
+            exit(EXIT_FAILURE);
+        }
+        if (*nBills == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            bills = resizeBuffer(bills, sizeof(Bill) * capacity);
+        }
+        Bill* bill = bills + *nBills;
+        bill->roomNum = viewToInt(fields[1]);
+        bill->boardType = viewToBoardType(fields[2]);
+        bill->nAdults = viewToInt(fields[3]);
+        bill->nChildren = viewToInt(fields[4]);
+        bill->arrival = viewToDay(fields[5]);
+        bill->departure = viewToDay(fields[6]);
+        bill->tableNum = viewToInt(fields[7]);
+        bill->tableSlot = viewToInt(fields[8]);
+        bill->tableDay = viewToDay(fields[9]);
+        bill->billDay = viewToDay(fields[10]);
+        bill->room = viewToPence(fields[11]);
+        bill->board = viewToPence(fields[12]);
+        bill->paper = viewToPence(fields[13]);
+        if (bill->boardType == NoBoard || bill->billDay == NO_DATE || bill->room < 0 || bill->board < 0 || bill->paper < 0) {
+            printf("error: %s:%d: invalid bill\n", billsFile, lineNum);
+            exit(EXIT_FAILURE);
+        }
+        (*nBills)++;
+    }
+    free(data);
+    return bills;
+}
+
+// Start a report over the nights [first, end)
+void initReport(Report* report, int first, int end)
+{
+    memset(report, 0, sizeof(Report));
+    report->roomNights = calloc(nRooms + 1, sizeof(int64_t));
+    report->roomRevenue = calloc(nRooms + 1, sizeof(int64_t));
+    if (report->roomNights == NULL || report->roomRevenue == NULL) {
+        printf("error: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    report->first = first;
+    report->end = end;
+    report->firstNight = INT_MAX;
+    report->endNight = INT_MIN;
+}
+
+// Release the per-room totals of a report
+void freeReport(Report* report)
+{
+    free(report->roomNights);
+    free(report->roomRevenue);
+    report->roomNights = report->roomRevenue = NULL;
+}
+
+// Add the totals of one part of a report into another
+void mergeReport(Report* report, const Report* part)
+{
+    if (part->firstNight < report->firstNight) report->firstNight = part->firstNight;
+    if (part->endNight > report->endNight) report->endNight = part->endNight;
+    report->nStays += part->nStays;
+    report->nAdults += part->nAdults;
+    report->nChildren += part->nChildren;
+    report->guestNights += part->guestNights;
+    report->nBilled += part->nBilled;
+    for (int room = 0; room <= nRooms; ++room) {
+        report->roomNights[room] += part->roomNights[room];
+        report->roomRevenue[room] += part->roomRevenue[room];
+    }
+    for (int type = 0; type < N_BOARD_TYPES; ++type) report->boardRevenue[type] += part->boardRevenue[type];
+    report->paperRevenue += part->paperRevenue;
+    for (int slot = 0; slot < nTimeSlots; ++slot) {
+        for (int table = 1; table <= nTables; ++table) report->tableNights[slot][table] += part->tableNights[slot][table];
+    }
+}
+
+// Add the nights and guests of one stay, and its table booking, to a report.
+// Only the nights before the departure and inside the period are counted
+void reportStay(Report* report, int room, int arrival, int departure, int nAdults, int nChildren,
+                int table, int timeSlot, int tableDay)
+{
+    if (arrival == NO_DATE || room < 1 || room > nRooms) return;
+    int from = arrival > report->first ? arrival : report->first;
+    int to = departure < report->end ? departure : report->end;
+    if (from < to) {
+        int nights = to - from;
+        if (from < report->firstNight) report->firstNight = from;
+        if (to > report->endNight) report->endNight = to;
+        report->nStays++;
+        report->nAdults += nAdults;
+        report->nChildren += nChildren;
+        report->guestNights += (int64_t)(nAdults + nChildren) * nights;
+        report->roomNights[room] += nights;
+    }
+    if (table >= 1 && table <= nTables && tableDay != NO_DATE && tableDay < departure
+        && tableDay >= report->first && tableDay < report->end) {
+        int slot = timeSlotIndex(timeSlot);
+        if (slot != -1) report->tableNights[slot][table]++;
+    }
+}
+
+// Add one booking in the store to a report. It has not been billed yet
+void reportBooking(const BookingStore* store, int idx, Report* report)
+{
+    const BookingColumns* columns = &store->columns;
+    reportStay(report, columns->roomNum[idx], columns->arrival[idx], columns->departure[idx],
+               columns->nAdults[idx], columns->nChildren[idx],
+               columns->tableNum[idx], columns->tableSlot[idx], columns->tableDay[idx]);
+}
+
+// Add the stay of a guest that checked out to a report, and their bill to
+// its revenue if it was made in the period. The stay ends when the guest
+// left, which is never after the day they were billed
+void reportBill(const Bill* bill, Report* report)
+{
+    int departure = bill->departure < bill->billDay ? bill->departure : bill->billDay;
+    reportStay(report, bill->roomNum, bill->arrival, departure, bill->nAdults, bill->nChildren,
+               bill->tableNum, bill->tableSlot, bill->tableDay);
+    if (bill->billDay <= report->first || bill->billDay > report->end) return;
+    int room = bill->roomNum >= 1 && bill->roomNum <= nRooms ? bill->roomNum : NO_ROOM;
+    report->nBilled++;
+    report->roomRevenue[room] += bill->room;
+    report->boardRevenue[bill->boardType] += bill->board;
+    report->paperRevenue += bill->paper;
+}
+
+// A report being built, with one part for each chunk of the stays: the
+// bookings in the store, followed by the bills
+typedef struct {
+    const BookingStore* store;
+    const Bill* bills;
+    Report* parts;
+} ReportBuild;
+
+// Total a chunk of the stays into its own part of a report
+void reportChunk(void* context, int chunk, int begin, int end)
+{
+    ReportBuild* build = context;
+    int nBookings = build->store->nBookings;
+    for (int idx = begin; idx < end; ++idx) {
+        if (idx < nBookings) {
+            reportBooking(build->store, idx, build->parts + chunk);
+        } else {
+            reportBill(build->bills + idx - nBookings, build->parts + chunk);
+        }
+    }
+}
+
+// Build a report over the nights [first, end) in one pass over the bookings
+// and the bills. Each thread totals its share of them into its own part, then
+// the parts are merged in order
+void buildReport(const BookingStore* store, const Bill* bills, int nBills, int first, int end, Report* report)
+{
+    initReport(report, first, end);
+    int nStays = store->nBookings + nBills;
+    int nChunks = loopChunks(nStays);
+    ReportBuild build = { store, bills, resizeBuffer(NULL, sizeof(Report) * nChunks) };
+    for (int i = 0; i < nChunks; ++i) initReport(build.parts + i, first, end);
+    parallelFor(nStays, nChunks, reportChunk, &build);
+    for (int i = 0; i < nChunks; ++i) {
+        mergeReport(report, build.parts + i);
+        freeReport(build.parts + i);
+    }
+    free(build.parts);
+    // A report over every stay covers the nights that were booked
+    if (first == INT_MIN) report->first = report->firstNight;
+    if (end == INT_MAX) report->end = report->endNight;
+}
+
+// Format a share of a total as a percentage
+void formatPercent(int64_t part, int64_t total, char* buffer)
+{
+    snprintf(buffer, MONEY_SIZE, "%.1f%%", total > 0 ? 100.0 * part / total : 0.0);
+}
+
+// Print the revenue, occupancy, guest and dining totals of a report
+void printReport(const Report* report, double seconds)
+{
+    int64_t nNights = report->end > report->first ? (int64_t)report->end - report->first : 0;
+    char from[11] = "-", to[11] = "-", money[MONEY_SIZE], percent[MONEY_SIZE];
+    if (nNights > 0) {
+        formatDay(report->first, from);
+        formatDay(report->end - 1, to);
+    }
+    printf("Report for the nights of %s to %s (%lld nights), in %.3fs\n", from, to, (long long)nNights, seconds);
+
+    int64_t occupiedNights = 0, revenue = report->paperRevenue;
+    for (int room = 0; room <= nRooms; ++room) {
+        occupiedNights += report->roomNights[room];
+        revenue += report->roomRevenue[room];
+    }
+    for (int type = FullBoard; type < N_BOARD_TYPES; ++type) revenue += report->boardRevenue[type];
+    formatPercent(occupiedNights, nNights * nRooms, percent);
+    printf("\nOccupancy: %lld of %lld room nights, %s\n", (long long)occupiedNights, (long long)(nNights * nRooms), percent);
+    printf("Guests: %lld stays, %lld adults, %lld children, %lld guest nights\n", (long long)report->nStays,
+           (long long)report->nAdults, (long long)report->nChildren, (long long)report->guestNights);
+    formatMoney(revenue, money);
+    printf("Revenue: %s from %lld bills made in the period\n", money, (long long)report->nBilled);
 
-        else if(roomChoice == 3 && room3Available == 1)
-        {
-            room3Available = 0;
-            printf("You have booked room 3\n__________________________\n");
-        }
+    printf("\n%-16s %8s %10s %12s\n", "Room", "Nights", "Occupancy", "Revenue");
+    for (int room = 1; room <= nRooms; ++room) {
+        formatPercent(report->roomNights[room], nNights, percent);
+        formatMoney(report->roomRevenue[room], money);
+        printf("%-16d %8lld %10s %12s\n", room, (long long)report->roomNights[room], percent, money);
+    }
+    if (report->roomRevenue[NO_ROOM] != 0) {
+        formatMoney(report->roomRevenue[NO_ROOM], money);
+        printf("%-16s %8s %10s %12s\n", "Other", "-", "-", money);
+    }
+    printf("\n%-16s %12s\n", "Board", "Revenue");
+    for (int type = FullBoard; type < N_BOARD_TYPES; ++type) {
+        formatMoney(report->boardRevenue[type], money);
+        printf("%-16s %12s\n", boardNames[type], money);
+    }
+    formatMoney(report->paperRevenue, money);
+    printf("%-16s %12s\n", "Newspapers", money);
 
-        else if(roomChoice == 4 && room4Available == 1)
-        {
-            room4Available = 0;
-            printf("You have booked room 4\n__________________________\n");
+    // Share of the nights each table was booked at each time slot
+    int width = tableNameWidth() > 5 ? tableNameWidth() : 5;
+    printf("\n%-*s", width, "Table");
+    char slotTime[TIME_SIZE];
+    for (int slot = 0; slot < nTimeSlots; ++slot) {
+        formatTimeSlot(timeSlots[slot], slotTime);
+        printf(" %8s", slotTime);
+    }
+    printf("\n");
+    for (int table = 1; table <= nTables; ++table) {
+        printf("%-*s", width, getTableName(table));
+        for (int slot = 0; slot < nTimeSlots; ++slot) {
+            formatPercent(report->tableNights[slot][table], nNights, percent);
+            printf(" %8s", percent);
         }
+        printf("\n");
+    }
+}
 
-        else if(roomChoice == 5 && room5Available == 1)
-        {
-            room5Available = 0;
-            printf("You have booked room 5\n__________________________\n");
-        }
+// Report on the nights [first, end), or on every stay when first is INT_MIN
+// and end is INT_MAX
+void runReport(BookingStore* store, int first, int end)
+{
+    double start = wallSeconds();
+    Report* report = malloc(sizeof(Report));
+    if (report == NULL) {
+        printf("error: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    int nBills;
+    Bill* bills = loadBills(store->filename, &nBills);
+    buildReport(store, bills, nBills, first, end, report);
+    printReport(report, wallSeconds() - start);
+    freeReport(report);
+    free(report);
+    free(bills);
+}
 
-        else if(roomChoice == 6 && room6Available == 1)
-        {
-            room6Available = 0;
-            printf("You have booked room 6\n__________________________\n");
-        }
+/* Server mode */
+#ifndef _WIN32
 
-        else 
-        {
-            printf("The room you selected is unavailable, please select a different one.\n");
-            selectedRoom = 0;
+// Immutable copy of a room's calendar, shared by snapshots until the room's
+// stays change
+typedef struct {
+    RoomCalendar calendar;
+    Stay stays[];
+} RoomView;
+
+// Immutable copy of the dining grid
+typedef struct {
+    DiningGrid grid;
+    unsigned char cells[];
+} DiningView;
+
+// Immutable summaries of the bookings whose ids hash to one bucket
+typedef struct {
+    int n;
+    BookingSummary summaries[];
+} IdBucket;
+
+// Read-only view of the bookings that answers the queries. Writers build the
+// next snapshot from the published one, copying only the rooms, bookings and
+// grid they changed, and publish it with a single atomic store
+typedef struct {
+    int today;
+    // When the date runs out, or 0 while it is pinned
+    time_t expires;
+    DiningView* dining;
+    IdBucket* ids[ID_VIEW_BUCKETS];
+    // Points just past the views of the rooms, in the same allocation
+    uint64_t* occupiedRooms;
+    // Indexed by room number
+    RoomView* rooms[];
+} Snapshot;
+
+// Memory that the published snapshot no longer uses, with the epoch it was
+// unlinked in
+typedef struct {
+    void* ptr;
+    unsigned long epoch;
+} Retired;
+
+// Shared state of a booking server. Worker threads serve one client
+// connection each.
+// Queries (rooms, free, tables, booking) take no locks: they read the
+// published snapshot, whose memory is only freed once every worker that might
+// hold it has moved on to a later epoch.
+// A room's lock is held while a booking decision about that room is made and
+// committed, so check-ins and check-outs for different rooms only meet on the
+// store lock. The store lock covers the shared indexes, the arena, the journal
+// and publishing snapshots, and is held only to look up or commit a change.
+// Locks are always taken room first, then store. A room's calendar is changed
+// only under both locks, so either one is enough to read its stay dates.
+// Journal records are appended under the store lock but synced after it is
+// released, under the sync lock, so that one sync covers every record
+// appended while the one before it ran
+typedef struct {
+    BookingStore* store;
+    pthread_mutex_t storeLock;
+    pthread_mutex_t syncLock;
+    // Number of changes appended to the journal, and synced to disk
+    long appended, synced;
+    // Indexed by room number
+    pthread_mutex_t* roomLocks;
+    _Atomic(Snapshot*) snapshot;
+    // Global epoch, and the epoch each worker entered its current read in,
+    // or 0 while it is not reading
+    atomic_ulong epoch;
+    atomic_ulong readerEpochs[MAX_SERVER_THREADS];
+    int nThreads;
+    // Retired memory, only touched under the store lock
+    Retired* retired;
+    int nRetired, retiredCapacity;
+    // Accepted connections waiting for a free worker, and the number of
+    // workers serving a client
+    int queue[SERVER_QUEUE_SIZE];
+    int queueHead, nQueued, nBusy;
+    pthread_mutex_t queueLock;
+    pthread_cond_t queueReady;
+} Server;
+
+// A worker thread and its slot in the reader epochs
+typedef struct {
+    Server* server;
+    int index;
+} Worker;
+
+// Get the lock of a room, with legacy bookings that have no valid room
+// sharing the lock of room 0
+pthread_mutex_t* roomLock(Server* server, int roomNum)
+{
+    return server->roomLocks + (roomNum >= 1 && roomNum <= nRooms ? roomNum : 0);
+}
+
+// Wait until a change, numbered in the order it was appended to the journal,
+// is on disk. The first worker to get here syncs every change appended so
+// far, while the others wait for it and usually find theirs covered
+void syncChange(Server* server, long change)
+{
+    pthread_mutex_lock(&server->syncLock);
+    if (server->synced < change) {
+        // A compaction may replace the journal during the sync, having synced
+        // the booking file first, so a duplicate of the current one is synced
+        pthread_mutex_lock(&server->storeLock);
+        long appended = server->appended;
+        fflush(server->store->journal);
+        int fd = dup(fileno(server->store->journal));
+        int billsFd = server->store->bills != NULL ? dup(fileno(server->store->bills)) : -1;
+        pthread_mutex_unlock(&server->storeLock);
+        fsync(fd);
+        close(fd);
+        if (billsFd != -1) {
+            fsync(billsFd);
+            close(billsFd);
         }
-    
+        server->synced = appended;
     }
-    booking.roomNum = roomChoice;
+    pthread_mutex_unlock(&server->syncLock);
+}
 
-    bookings[nBookings] = booking;
-    nBookings++;
+// Copy a room's calendar into a new view
+RoomView* viewRoom(const RoomCalendar* calendar)
+{
+    RoomView* view = resizeBuffer(NULL, sizeof(RoomView) + sizeof(Stay) * calendar->nStays);
+    if (calendar->nStays > 0) memcpy(view->stays, calendar->stays, sizeof(Stay) * calendar->nStays);
+    view->calendar.stays = view->stays;
+    view->calendar.nStays = view->calendar.capacity = calendar->nStays;
+    return view;
+}
 
-    saveBookingData(BOOKING_FILE, bookings, nBookings);
+// Copy the dining grid into a new view
+DiningView* viewDining(const DiningGrid* grid)
+{
+    size_t size = (size_t)nTimeSlots * nTables * grid->nDays;
+    DiningView* view = resizeBuffer(NULL, sizeof(DiningView) + size);
+    if (size > 0) memcpy(view->cells, grid->cells, size);
+    view->grid.cells = view->cells;
+    view->grid.firstDay = grid->firstDay;
+    view->grid.nDays = grid->nDays;
+    return view;
 }
 
-void checkOut()
+// When the store's date runs out, or 0 while it is pinned
+time_t dateExpires()
 {
-    Booking bookings[N_ROOMS];
-    int nbookings = loadBookingData(BOOKING_FILE, bookings);
-    // Booking ID
-    int roomnum = -1,year = 0, i = 0;
-    float total = 0;
-    printf("Enter your booking ID: ");
-    char* bokid = inputString();
-    for (i = 0; i < nbookings ; i++){
-        if (strcmp(bookings[i].id,bokid) == 0){
-            roomnum = i;
-            break;
+    return pinnedDay != NO_DATE ? 0 : nextDayBoundary;
+}
+
+// Queue memory that is no longer reachable from the published snapshot to be
+// freed, tagged with the current epoch
+void retire(Server* server, void* ptr)
+{
+    if (ptr == NULL) return;
+    if (server->nRetired == server->retiredCapacity) {
+        server->retiredCapacity = server->retiredCapacity ? server->retiredCapacity * 2 : 64;
+        server->retired = resizeBuffer(server->retired, sizeof(Retired) * server->retiredCapacity);
+    }
+    server->retired[server->nRetired].ptr = ptr;
+    server->retired[server->nRetired].epoch = atomic_load(&server->epoch);
+    server->nRetired++;
+}
+
+// Free the retired memory that no reader can still hold: a reader that
+// entered in a later epoch than the memory was retired in found the snapshot
+// that replaced it
+void reclaim(Server* server)
+{
+    unsigned long oldest = atomic_load(&server->epoch);
+    for (int i = 0; i < server->nThreads; ++i) {
+        unsigned long epoch = atomic_load(server->readerEpochs + i);
+        if (epoch != 0 && epoch < oldest) oldest = epoch;
+    }
+    int nKept = 0;
+    for (int i = 0; i < server->nRetired; ++i) {
+        if (server->retired[i].epoch < oldest) {
+            free(server->retired[i].ptr);
+        } else {
+            server->retired[nKept++] = server->retired[i];
         }
     }
-    if (roomnum == -1){
-        printf("Invalid booking ID\n");
-        return;
+    server->nRetired = nKept;
+}
+
+// Size of a snapshot, which holds the views of the rooms and the occupancy
+// bitmap after its fixed fields
+size_t snapshotSize()
+{
+    return sizeof(Snapshot) + sizeof(RoomView*) * (nRooms + 1) + sizeof(uint64_t) * nRoomWords;
+}
+
+// Allocate a snapshot as a copy of another, or empty for NULL
+Snapshot* newSnapshot(const Snapshot* from)
+{
+    Snapshot* snapshot = resizeBuffer(NULL, snapshotSize());
+    if (from != NULL) {
+        memcpy(snapshot, from, snapshotSize());
+    } else {
+        memset(snapshot, 0, snapshotSize());
     }
-    int nMeals = -1;
-    do {
-        printf("How many meals have you had? ");
-        scanf("%d", &nMeals);
-        fflush(stdin);
-    } while (nMeals < 0);
+    snapshot->occupiedRooms = (uint64_t*)(snapshot->rooms + nRooms + 1);
+    return snapshot;
+}
 
-    time_t s, val = 1;
-    struct tm* current_time;
-    s = time(NULL);
-    current_time = localtime(&s);
+// Build and publish the first snapshot from the whole store
+void initSnapshot(Server* server)
+{
+    BookingStore* store = server->store;
+    Snapshot* snapshot = newSnapshot(NULL);
+    snapshot->today = store->today;
+    snapshot->expires = dateExpires();
+    memcpy(snapshot->occupiedRooms, store->occupiedRooms, sizeof(uint64_t) * nRoomWords);
+    for (int room = 1; room <= nRooms; ++room) snapshot->rooms[room] = viewRoom(store->calendars + room);
+    snapshot->dining = viewDining(&store->dining);
+    // Size the id buckets, then fill them
+    int counts[ID_VIEW_BUCKETS] = { 0 };
+    for (int i = 0; i < store->nBookings; ++i) {
+        if (store->columns.id[i] != NULL) counts[hashId(store->columns.id[i]) % ID_VIEW_BUCKETS]++;
+    }
+    for (int bucket = 0; bucket < ID_VIEW_BUCKETS; ++bucket) {
+        snapshot->ids[bucket] = resizeBuffer(NULL, sizeof(IdBucket) + sizeof(BookingSummary) * counts[bucket]);
+        snapshot->ids[bucket]->n = 0;
+    }
+    for (int i = 0; i < store->nBookings; ++i) {
+        if (store->columns.id[i] == NULL) continue;
+        IdBucket* ids = snapshot->ids[hashId(store->columns.id[i]) % ID_VIEW_BUCKETS];
+        summarizeBooking(store, i, ids->summaries + ids->n++);
+    }
+    atomic_store(&server->epoch, 1);
+    atomic_store(&server->snapshot, snapshot);
+}
 
-    int bday,bmonth,byear;
-    parseDateTimeString(bookings[roomnum].dob, &bday, &bmonth, &byear);
-    printf("==========================\n");
-    printf("Thank you for staying at\nThe Kashyyyk Hotel\n");
-    printf("==========================\n");
-    printf("Date of bill: %d.%d.%d\n",
-           current_time->tm_mday,
-           current_time->tm_mon + 1,
-           current_time->tm_year + 1900);
-    printf("Booking ID: %s\n", bokid);
-    printf("Main user: %s %s\n", bookings[roomnum].firstName, bookings[roomnum].lastName);
-    printf("number of adults: %d\n",bookings[roomnum].nAdults);
-    printf("number of children: %d\n",bookings[roomnum].nChildren);
-    printf("Room stayed in: %d\n",bookings[roomnum].roomNum + 1);
-    printf("--------------------------\n");
+// Start the next snapshot as a copy of the published one, brought up to the
+// store's date and occupancy. Called under the store lock, as are the
+// functions below that fill it in
+Snapshot* beginSnapshot(Server* server)
+{
+    Snapshot* next = newSnapshot(atomic_load(&server->snapshot));
+    next->today = server->store->today;
+    next->expires = dateExpires();
+    memcpy(next->occupiedRooms, server->store->occupiedRooms, sizeof(uint64_t) * nRoomWords);
+    return next;
+}
+
+// Replace a room's calendar in the next snapshot
+void snapshotRoom(Server* server, Snapshot* next, int roomNum)
+{
+    if (roomNum < 1 || roomNum > nRooms) return;
+    retire(server, next->rooms[roomNum]);
+    next->rooms[roomNum] = viewRoom(server->store->calendars + roomNum);
+}
 
-    //fb = 20, hb = 15, bb = 5
-    float afc = 0,cfc = 0,tfc = 0;
-    char str1[] = "FB", str2[] = "HB", str3[] = "BB";
+// Replace the dining grid in the next snapshot
+void snapshotDining(Server* server, Snapshot* next)
+{
+    retire(server, next->dining);
+    next->dining = viewDining(&server->store->dining);
+}
 
-    if(strcmp(bookings[roomnum].boardType, str1) == 0) {
-        afc = bookings[roomnum].nAdults * 20 * nMeals;
-        cfc = bookings[roomnum].nChildren * 20 * nMeals / 2;
-        tfc = cfc + afc;
+// Bring a booking's summary in the next snapshot up to date, dropping it if
+// the booking has checked out. Only the booking's bucket is copied
+void snapshotBooking(Server* server, Snapshot* next, const char* id)
+{
+    int bucket = hashId(id) % ID_VIEW_BUCKETS;
+    IdBucket* old = next->ids[bucket];
+    IdBucket* ids = resizeBuffer(NULL, sizeof(IdBucket) + sizeof(BookingSummary) * (old->n + 1));
+    ids->n = 0;
+    for (int i = 0; i < old->n; ++i) {
+        if (strcmp(old->summaries[i].id, id) != 0) ids->summaries[ids->n++] = old->summaries[i];
     }
-    else if(strcmp(bookings[roomnum].boardType, str2) == 0) {
-        afc = afc + bookings[roomnum].nAdults * 15 * nMeals;
-        cfc = cfc + bookings[roomnum].nChildren * 15 * nMeals / 2;
-        tfc = cfc + afc;
+    int idx = findBookingById(server->store, id);
+    if (idx != NO_BOOKING) summarizeBooking(server->store, idx, ids->summaries + ids->n++);
+    retire(server, old);
+    next->ids[bucket] = ids;
+}
+
+// Publish the next snapshot and retire the one it replaces, then move on to
+// a new epoch and free what no reader can hold any more
+void publishSnapshot(Server* server, Snapshot* next)
+{
+    retire(server, atomic_exchange(&server->snapshot, next));
+    atomic_fetch_add(&server->epoch, 1);
+    reclaim(server);
+}
+
+// Move the store on to the current day under the store lock, publishing a
+// new snapshot if the date of the published one is out of date
+void refreshServer(Server* server)
+{
+    refreshOccupancy(server->store);
+    const Snapshot* snapshot = atomic_load(&server->snapshot);
+    if (snapshot->today != server->store->today || snapshot->expires != dateExpires()) {
+        publishSnapshot(server, beginSnapshot(server));
     }
+}
+
+// End a worker's read of the published snapshot
+void leaveSnapshot(Server* server, int worker)
+{
+    atomic_store(server->readerEpochs + worker, 0);
+}
 
-    else if(strcmp(bookings[roomnum].boardType, str3) == 0) {
-        afc = afc + bookings[roomnum].nAdults * 5 * nMeals;
-        cfc = cfc + bookings[roomnum].nChildren * 5 * nMeals / 2;
-        tfc = cfc + afc;
+// Start a worker's read of the published snapshot, which stays valid until
+// leaveSnapshot. A snapshot whose date has run out is replaced first
+const Snapshot* enterSnapshot(Server* server, int worker)
+{
+    for (;;) {
+        atomic_store(server->readerEpochs + worker, atomic_load(&server->epoch));
+        const Snapshot* snapshot = atomic_load(&server->snapshot);
+        if (snapshot->expires == 0 || time(NULL) < snapshot->expires) return snapshot;
+        leaveSnapshot(server, worker);
+        pthread_mutex_lock(&server->storeLock);
+        refreshServer(server);
+        pthread_mutex_unlock(&server->storeLock);
     }
+}
 
-    else {
-        printf("Error with board type\n");
+// rooms [<max price>], from a snapshot
+const char* queryRooms(const Snapshot* snapshot, StringView* fields, int nFields, char* result)
+{
+    if (nFields > 1) return "rooms expects at most 1 field";
+    uint64_t rooms[MAX_ROOM_WORDS];
+    roomsWithin(nFields == 1 ? viewToInt(fields[0]) : ANY_PRICE, rooms);
+    for (int i = 0; i < nRoomWords; ++i) rooms[i] &= ~snapshot->occupiedRooms[i];
+    snprintf(result, BATCH_RESULT_SIZE, "%d free, first %d", countRooms(rooms), nextRoom(rooms, 0));
+    return NULL;
+}
+
+// free <from>,<to>[,<max price>], from a snapshot
+const char* queryFreeRooms(const Snapshot* snapshot, StringView* fields, int nFields, char* result)
+{
+    if (nFields != 2 && nFields != 3) return "free expects 2 or 3 fields";
+    int from = viewToDay(fields[0]), to = viewToDay(fields[1]);
+    if (from == NO_DATE || to == NO_DATE || to <= from) return "invalid date range";
+    uint64_t rooms[MAX_ROOM_WORDS];
+    roomsWithin(nFields == 3 ? viewToInt(fields[2]) : ANY_PRICE, rooms);
+    for (int room = nextRoom(rooms, 0); room != NO_ROOM; room = nextRoom(rooms, room)) {
+        if (!calendarFreeBetween(&snapshot->rooms[room]->calendar, from, to)) {
+            rooms[(room - 1) / 64] &= ~(1ull << ((room - 1) % 64));
+        }
     }
-    printf("Total adult board price: £%.2f\n", afc);
-    printf("Total child board price: £%.2f\n", cfc);
-    printf("Total board price: £%.2f\n", tfc);
-    total = total + tfc;
+    snprintf(result, BATCH_RESULT_SIZE, "%d free, first %d", countRooms(rooms), nextRoom(rooms, 0));
+    return NULL;
+}
 
-    float rpt = 0;
-    rpt = roomPrices[bookings[roomnum].roomNum];
-    int daysold = daysElapsed(bookings[roomnum].dob,currentDate());
-    if (daysold >= (65 * 365.25f)){
-        rpt = rpt * 0.9;
+// tables [<night>], from a snapshot
+const char* queryTables(const Snapshot* snapshot, StringView* fields, int nFields, char* result)
+{
+    if (nFields > 1) return "tables expects at most 1 field";
+    int day = nFields == 1 ? viewToDay(fields[0]) : snapshot->today;
+    if (day == NO_DATE) return "invalid date";
+    formatFreeTables(&snapshot->dining->grid, day, result);
+    return NULL;
+}
+
+// booking <booking id>, from a snapshot
+const char* queryFind(const Snapshot* snapshot, StringView* fields, int nFields, char* result)
+{
+    if (nFields != 1) return "booking expects 1 field";
+    const IdBucket* ids = snapshot->ids[hashId(fields[0].ptr) % ID_VIEW_BUCKETS];
+    for (int i = 0; i < ids->n; ++i) {
+        if (strcmp(ids->summaries[i].id, fields[0].ptr) != 0) continue;
+        formatBookingSummary(ids->summaries + i, result);
+        return NULL;
     }
-    printf("Room total: %.2f\n", rpt);
+    return "invalid booking id";
+}
 
-    total = total + rpt;
-    if (bookings[roomnum].paper == 1){
-        printf("Newspaper: 5.50\n");
-        total = total + 5.5;
+// checkin, as in batch mode. The fields are checked against the snapshot's
+// date before any lock is taken, then each candidate room is locked in turn
+// while its calendar is checked
+const char* serveCheckIn(Server* server, int worker, StringView* fields, int nFields, char* result)
+{
+    BookingStore* store = server->store;
+    Booking booking;
+    const char* error = parseCheckIn(fields, nFields, enterSnapshot(server, worker)->today, &booking);
+    leaveSnapshot(server, worker);
+    if (error != NULL) return error;
+    int first = booking.roomNum, last = booking.roomNum;
+    if (booking.roomNum == NO_ROOM) {
+        first = 1;
+        last = nRooms;
     }
-    printf("--------------------------\n");
-    printf("Total price: %.2f\n", total);
-    printf("==========================\n");
+    for (int room = first; room <= last; ++room) {
+        pthread_mutex_lock(roomLock(server, room));
+        if (!roomFreeBetween(store, room, booking.arrival, booking.departure)) {
+            pthread_mutex_unlock(roomLock(server, room));
+            continue;
+        }
+        booking.roomNum = room;
+        pthread_mutex_lock(&server->storeLock);
+        refreshServer(server);
+        // The names point into the client's line buffer until the commit
+        // copies them into the store
+        commitCheckIn(store, &booking);
+        Snapshot* next = beginSnapshot(server);
+        snapshotRoom(server, next, room);
+        snapshotBooking(server, next, booking.id);
+        publishSnapshot(server, next);
+        long change = ++server->appended;
+        pthread_mutex_unlock(&server->storeLock);
+        pthread_mutex_unlock(roomLock(server, room));
+        syncChange(server, change);
+        snprintf(result, BATCH_RESULT_SIZE, "%s room %d", booking.id, booking.roomNum);
+        return NULL;
+    }
+    return "room is unavailable";
+}
 
-    removeBooking(bookings, roomnum,&nbookings);
-    saveBookingData(BOOKING_FILE, bookings, nbookings);
-    printf("Thank you for staying at The Kashyyyk Hotel\n");
+// checkout, as in batch mode, under the lock of the booking's room
+const char* serveCheckOut(Server* server, StringView* fields, int nFields, char* result)
+{
+    BookingStore* store = server->store;
+    if (nFields != 2) return "checkout expects 2 fields";
+    pthread_mutex_lock(&server->storeLock);
+    int idx = findBookingById(store, fields[0].ptr);
+    int room = idx != NO_BOOKING ? store->columns.roomNum[idx] : NO_ROOM;
+    pthread_mutex_unlock(&server->storeLock);
+    if (idx == NO_BOOKING) return "invalid booking id";
+    // The booking may have checked out in between, which the batch command
+    // reports, but it cannot have changed room
+    pthread_mutex_lock(roomLock(server, room));
+    pthread_mutex_lock(&server->storeLock);
+    refreshServer(server);
+    idx = findBookingById(store, fields[0].ptr);
+    int hadTable = idx != NO_BOOKING && store->columns.tableNum[idx] > 0;
+    const char* error = batchCheckOut(store, fields, nFields, result);
+    long change = 0;
+    if (error == NULL) {
+        Snapshot* next = beginSnapshot(server);
+        snapshotRoom(server, next, room);
+        snapshotBooking(server, next, fields[0].ptr);
+        if (hadTable) snapshotDining(server, next);
+        publishSnapshot(server, next);
+        change = ++server->appended;
+    }
+    pthread_mutex_unlock(&server->storeLock);
+    pthread_mutex_unlock(roomLock(server, room));
+    if (change > 0) syncChange(server, change);
+    return error;
 }
 
-// Table booking function (Tom)
-void bookTable()
-{
-    // Load booking data
-    Booking bookings[N_ROOMS];
-    int nBookings = loadBookingData(BOOKING_FILE, bookings), bookingIdx = -1;
-    // Create a 2D array of all possible booking slots at each table
-    int timeSlots[N_TIMESLOTS] = { 7, 9 };
-    int tables[N_TABLES] = { Endor, Naboo, Tatooine };
-    int tablesAvailable[N_TIMESLOTS][N_TABLES] = { { Endor, Naboo, Tatooine }, { Endor, Naboo, Tatooine } };
-    // Check booking ID
-    print(500, "In order to book a table, please enter your booking ID: ");
-    char* bookingId = inputString();
-    for (int i = 0; i < nBookings; ++i) {
-        for (int timeSlotIdx = 0; timeSlotIdx < N_TIMESLOTS; ++timeSlotIdx) {
-            for (int tableIdx = 0; tableIdx < N_TABLES; ++tableIdx) {
-                if (timeSlots[timeSlotIdx] == bookings[i].tableSlot && tables[tableIdx] == bookings[i].tableNum) {
-                    tablesAvailable[timeSlotIdx][tableIdx] = TABLE_UNAVAILABLE;
-                }
-            }
+// booktable or canceltable, as in batch mode, under the store lock
+const char* serveTable(Server* server, const char* (*command)(BookingStore*, StringView*, int, char*),
+                       StringView* fields, int nFields, char* result)
+{
+    pthread_mutex_lock(&server->storeLock);
+    refreshServer(server);
+    const char* error = command(server->store, fields, nFields, result);
+    long change = 0;
+    if (error == NULL) {
+        Snapshot* next = beginSnapshot(server);
+        snapshotDining(server, next);
+        snapshotBooking(server, next, fields[0].ptr);
+        publishSnapshot(server, next);
+        change = ++server->appended;
+    }
+    pthread_mutex_unlock(&server->storeLock);
+    if (change > 0) syncChange(server, change);
+    return error;
+}
+
+// Run one command line from a worker's client. Queries read the published
+// snapshot without taking any lock, while changes take the locks they need
+// and publish a new snapshot
+const char* serveCommand(Server* server, int worker, char* line, char* result)
+{
+    StringView fields[16];
+    char* args = strchr(line, ' ');
+    if (args != NULL) *args++ = '\0';
+    int nFields = args != NULL ? splitFields(trim(args), fields, 16) : 0;
+
+    const char* (*query)(const Snapshot*, StringView*, int, char*) = NULL;
+    if (strcmp(line, "rooms") == 0) query = queryRooms;
+    else if (strcmp(line, "free") == 0) query = queryFreeRooms;
+    else if (strcmp(line, "tables") == 0) query = queryTables;
+    else if (strcmp(line, "booking") == 0) query = queryFind;
+    if (query != NULL) {
+        const char* error = query(enterSnapshot(server, worker), fields, nFields, result);
+        leaveSnapshot(server, worker);
+        return error;
+    }
+
+    if (strcmp(line, "checkin") == 0) return serveCheckIn(server, worker, fields, nFields, result);
+    if (strcmp(line, "checkout") == 0) return serveCheckOut(server, fields, nFields, result);
+    if (strcmp(line, "booktable") == 0) return serveTable(server, batchBookTable, fields, nFields, result);
+    if (strcmp(line, "canceltable") == 0) return serveTable(server, batchCancelTable, fields, nFields, result);
+    // The batch today command is not served: the date is shared by every desk,
+    // so it can only be pinned when the server is started, with --today
+    return "unknown command";
+}
+
+// Answer a client's commands, one reply line per command line, until it
+// disconnects
+void serveClient(Server* server, int worker, int client)
+{
+    FILE* in = fdopen(client, "r");
+    FILE* out = fdopen(dup(client), "w");
+    if (in == NULL || out == NULL) {
+        if (in != NULL) fclose(in); else close(client);
+        if (out != NULL) fclose(out);
+        return;
+    }
+    char line[SERVER_LINE_SIZE], result[BATCH_RESULT_SIZE];
+    while (fgets(line, sizeof(line), in) != NULL) {
+        const char* error;
+        *result = '\0';
+        if (strchr(line, '\n') == NULL && !feof(in)) {
+            // Skip the rest of an overlong line rather than run its tail
+            int c;
+            while ((c = getc(in)) != '\n' && c != EOF);
+            error = "line too long";
+        } else {
+            char* command = trim(line);
+            if (*command == '\0' || *command == '#') continue;
+            error = serveCommand(server, worker, command, result);
         }
-        if (strcmp(bookings[i].id, bookingId) == 0) {
-            bookingIdx = i;
-            break;
+        if (error != NULL) {
+            fprintf(out, "error: %s\n", error);
+        } else {
+            fprintf(out, "ok%s%s\n", *result ? " " : "", result);
         }
+        if (fflush(out) != 0) break;
     }
-    if (bookingIdx == -1) {
-        print(500, "Sorry, that is an invalid booking ID, you cannot book a table.\n");
-        return;
-    } else if (bookings[bookingIdx].boardType == "BB") {
-        print(500, "Sorry, you are booked in for Bed & Breakfast, meaning you cannot book a dinner table.\n");
-        return;
-    } else if ((bookings[bookingIdx].tableNum != TABLE_UNAVAILABLE && bookings[bookingIdx].tableNum != INVALID_TABLE_ENTRY) ||
-               (bookings[bookingIdx].tableSlot != TABLE_UNAVAILABLE && bookings[bookingIdx].tableSlot != INVALID_TABLE_ENTRY)) {
-        print(
-                500,
-                "You currently have a table booked: %s at %d:00pm\n",
-                getTableName(bookings[bookingIdx].tableNum, 0),
-                bookings[bookingIdx].tableSlot % 12 + 12
-        );
-        char choice;
-        do {
-            print(200, "Would you like to cancel your table booking? (Y/N) ");
-            scanf("%c", &choice);
-            fflush(stdin);
-        } while (choice != 'Y' && choice != 'N' && choice != 'y' && choice != 'n');
-        if (choice == 'N' || choice == 'n') return;
-        bookings[bookingIdx].tableNum = INVALID_TABLE_ENTRY;
-        bookings[bookingIdx].tableSlot = INVALID_TABLE_ENTRY;
-        saveBookingData(BOOKING_FILE, bookings, nBookings);
-        return;
+    fclose(in);
+    fclose(out);
+}
+
+// Worker thread of the pool: take accepted connections off the queue and
+// serve them
+void* serverWorker(void* arg)
+{
+    Worker* worker = arg;
+    Server* server = worker->server;
+    for (;;) {
+        pthread_mutex_lock(&server->queueLock);
+        while (server->nQueued == 0) pthread_cond_wait(&server->queueReady, &server->queueLock);
+        int client = server->queue[server->queueHead];
+        server->queueHead = (server->queueHead + 1) % SERVER_QUEUE_SIZE;
+        server->nQueued--;
+        server->nBusy++;
+        pthread_mutex_unlock(&server->queueLock);
+        serveClient(server, worker->index, client);
+        pthread_mutex_lock(&server->queueLock);
+        server->nBusy--;
+        pthread_mutex_unlock(&server->queueLock);
     }
-    int confirmChoice = 0;
-    while (!confirmChoice) {
-        // Display available tables
-        print(200, "Available tables: \n-----------------\n");
-        int idx = 0, newIdx = 0, tableChoice;
-        for (int i = 0; i < N_TIMESLOTS; ++i) {
-            for (int j = 0; j < N_TABLES; ++j) {
-                if (tablesAvailable[i][j] == TABLE_UNAVAILABLE) continue;
-                print(100, "%d: %s | %d:00pm | Serves 4\n", idx + 1, getTableName(tablesAvailable[i][j], 1), (timeSlots[i] + 12) % 24);
-                idx++;
-            }
+    return NULL;
+}
+
+// Keep the booking set in memory and serve the batch commands to front desk
+// clients over a Unix socket, using a pool of nThreads workers. A worker
+// serves one desk until it disconnects, so at most nThreads desks can be
+// connected at once: any more are sent a server busy error and disconnected.
+// Every change is journaled and synced before it is acknowledged, so the
+// server can simply be killed when it is no longer needed
+void runServer(BookingStore* store, const char* path, int nThreads)
+{
+    Server server;
+    memset(&server, 0, sizeof(server));
+    server.store = store;
+    pthread_mutex_init(&server.storeLock, NULL);
+    pthread_mutex_init(&server.syncLock, NULL);
+    server.roomLocks = resizeBuffer(NULL, sizeof(pthread_mutex_t) * (nRooms + 1));
+    for (int room = 0; room <= nRooms; ++room) pthread_mutex_init(server.roomLocks + room, NULL);
+    pthread_mutex_init(&server.queueLock, NULL);
+    pthread_cond_init(&server.queueReady, NULL);
+
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address.sun_path)) {
+        printf("error: socket path %s is too long\n", path);
+        exit(EXIT_FAILURE);
+    }
+    strcpy(address.sun_path, path);
+    // A socket left behind by a server that was killed would block the bind.
+    // Anything else at the path is left alone, so a mistyped path cannot
+    // delete the booking data
+    struct stat existing;
+    if (lstat(path, &existing) == 0) {
+        if (!S_ISSOCK(existing.st_mode)) {
+            printf("error: %s exists and is not a socket\n", path);
+            exit(EXIT_FAILURE);
         }
-        printf("\n");
-        do {
-            print(200, "Please select the table you want (1-%d): ", idx);
-            scanf("%d", &tableChoice);
-            fflush(stdin);
-        } while (1 > tableChoice || tableChoice > idx);
+        unlink(path);
+    }
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0 || bind(listener, (struct sockaddr*)&address, sizeof(address)) != 0
+        || listen(listener, SERVER_QUEUE_SIZE) != 0) {
+        printf("error: could not listen on %s: %s\n", path, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    // A client that disconnects mid-reply must not take the server down
+    signal(SIGPIPE, SIG_IGN);
+    // The server holds the lock on the booking data for as long as it runs,
+    // so its store is never stale and commits never need to be retried. It
+    // leaves the path of its socket next to the booking data, so that desks
+    // and batch runs that cannot get the lock are told to use --connect, while
+    // reports read the data without the lock
+    waitForBookingData(store);
+    char serverFile[FILENAME_MAX], socketPath[FILENAME_MAX];
+    serverFilename(serverFile, sizeof(serverFile), store->filename);
+    FILE* serverInfo = fopen(serverFile, "w");
+    if (serverInfo != NULL) {
+        fprintf(serverInfo, "%s\n", realpath(path, socketPath) != NULL ? socketPath : path);
+        fclose(serverInfo);
+    }
+    store->deferSync = 1;
+    refreshOccupancy(store);
+    initSnapshot(&server);
+    server.nThreads = nThreads;
+    pthread_t threads[MAX_SERVER_THREADS];
+    Worker workers[MAX_SERVER_THREADS];
+    for (int i = 0; i < nThreads; ++i) {
+        workers[i].server = &server;
+        workers[i].index = i;
+        if (pthread_create(threads + i, NULL, serverWorker, workers + i) != 0) {
+            printf("error: could not start worker thread\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    printf("Serving %d bookings on %s to up to %d desks at once\n", store->nBookings, path, nThreads);
+    fflush(stdout);
 
-        int tempTableNum = 0, tempTableSlot = 0;
-        for (int i = 0; i < N_TIMESLOTS; ++i) {
-            for (int j = 0; j < N_TABLES; ++j) {
-                if (tablesAvailable[i][j] == TABLE_UNAVAILABLE) continue;
-                if (tableChoice == newIdx + 1) {
-                    tempTableNum = tablesAvailable[i][j];
-                    tempTableSlot = timeSlots[i];
-                }
-                newIdx++;
-            }
+    for (;;) {
+        int client = accept(listener, NULL, NULL);
+        if (client < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            printf("error: could not accept a connection: %s\n", strerror(errno));
+            exit(EXIT_FAILURE);
         }
-        printf(
-                "You have selected: %s at %d:00pm\n",
-                getTableName(tempTableNum, 0),
-                (tempTableSlot + 12) % 24
-        );
-        char choice;
-        do {
-            print(200, "Would you like to confirm your booking? (Y/N) ");
-            scanf("%c", &choice);
-            fflush(stdin);
-        } while (choice != 'Y' && choice != 'N' && choice != 'y' && choice != 'n');
-        if (choice == 'Y' || choice == 'y') {
-            bookings[bookingIdx].tableNum = tempTableNum;
-            bookings[bookingIdx].tableSlot = tempTableSlot;
-            confirmChoice = 1;
+        pthread_mutex_lock(&server.queueLock);
+        if (server.nBusy + server.nQueued == nThreads) {
+            // Every worker has a desk: refuse rather than leave this one
+            // hanging until another disconnects
+            pthread_mutex_unlock(&server.queueLock);
+            char reply[SERVER_LINE_SIZE];
+            int length = snprintf(reply, sizeof(reply), "%s (%d desks connected, start it with more --threads)\n", SERVER_BUSY, nThreads);
+            send(client, reply, length, 0);
+            close(client);
+            continue;
         }
+        server.queue[(server.queueHead + server.nQueued) % SERVER_QUEUE_SIZE] = client;
+        server.nQueued++;
+        pthread_cond_signal(&server.queueReady);
+        pthread_mutex_unlock(&server.queueLock);
     }
-    saveBookingData(BOOKING_FILE, bookings, nBookings);
-    print(
-            500,
-            "Successfully booked a table for %s at %d:00pm\n",
-            getTableName(bookings[bookingIdx].tableNum, 0),
-            (bookings[bookingIdx].tableSlot + 12) % 24
-    );
+}
+
+// Send commands from stdin to a running server, one per line, and print each
+// reply. Returns the number of failed commands
+int runClient(const char* path)
+{
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, path, sizeof(address.sun_path) - 1);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr*)&address, sizeof(address)) != 0) {
+        printf("error: could not connect to %s: %s\n", path, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    // A busy server answers with an error and hangs up before reading the
+    // first command, so a failed write must not kill the client before the
+    // error is read
+    signal(SIGPIPE, SIG_IGN);
+    FILE* in = fdopen(fd, "r");
+    FILE* out = fdopen(dup(fd), "w");
+    char line[SERVER_LINE_SIZE], reply[SERVER_LINE_SIZE];
+    int nFailed = 0;
+    while (fgets(line, sizeof(line), stdin) != NULL) {
+        char* command = trim(line);
+        if (*command == '\0' || *command == '#') continue;
+        fprintf(out, "%s\n", command);
+        fflush(out);
+        if (fgets(reply, sizeof(reply), in) == NULL) {
+            printf("error: lost the connection to %s\n", path);
+            exit(EXIT_FAILURE);
+        }
+        fputs(reply, stdout);
+        if (strncmp(reply, SERVER_BUSY, strlen(SERVER_BUSY)) == 0) exit(EXIT_FAILURE);
+        nFailed += strncmp(reply, "error", 5) == 0;
+    }
+    fclose(in);
+    fclose(out);
+    return nFailed;
+}
+
+#endif
+
+// Convert a booking file (and its journal) between the text and binary formats.
+// The source is only read, so it is left exactly as it was
+void convertBookingData(const char* source, const char* destination)
+{
+    struct stat info;
+    if (stat(source, &info) != 0) {
+        printf("error: could not open %s\n", source);
+        exit(EXIT_FAILURE);
+    }
+    BookingStore store;
+    initBookingStore(&store);
+    loadBookingSnapshot(source, &store);
+    store.binary = !store.binary;
+    saveBookingData(destination, &store);
+    printf("Converted %d bookings to the %s format\n", store.nBookings, store.binary ? "binary" : "text");
+    freeBookingStore(&store);
 }
 
 // Main user interface
@@ -848,25 +4767,165 @@ int main(const int argc, const char** argv)
 {
     setlocale(LC_CTYPE, ""); // enable utf-8 in the console
     srand(time(NULL));
+    initCharClasses();
+    const char* filename = BOOKING_FILE;
+    const char* batchFile = NULL;
+    const char* importFile = NULL;
+    const char* billDate = NULL;
+    const char* reportPeriod = NULL;
+    const char* serverPath = NULL;
+    const char* convertSource = NULL;
+    const char* convertDestination = NULL;
+    int nThreads = SERVER_THREADS;
+    const char* fastEnv = getenv("KASHYYYK_FAST");
+    fastMode = fastEnv != NULL && strcmp(fastEnv, "0") != 0;
+    const char* threadsEnv = getenv("KASHYYYK_THREADS");
+    nLoopThreads = threadsEnv != NULL ? atoi(threadsEnv) : countCores();
+    if (nLoopThreads < 1) nLoopThreads = 1;
+    if (nLoopThreads > MAX_LOOP_THREADS) nLoopThreads = MAX_LOOP_THREADS;
+    const char* today = getenv("KASHYYYK_TODAY");
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--convert") == 0 && i + 2 < argc) {
+            convertSource = argv[++i];
+            convertDestination = argv[++i];
+        } else if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc) {
+            batchFile = argv[++i];
+        } else if (strcmp(argv[i], "--serve") == 0 && i + 1 < argc) {
+            serverPath = argv[++i];
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            nThreads = atoi(argv[++i]);
+            if (nThreads < 1 || nThreads > MAX_SERVER_THREADS) {
+                printf("error: the server can use between 1 and %d threads\n", MAX_SERVER_THREADS);
+                exit(EXIT_FAILURE);
+            }
+        } else if (strcmp(argv[i], "--connect") == 0 && i + 1 < argc) {
+#ifdef _WIN32
+            printf("error: the booking server needs Unix sockets\n");
+            return EXIT_FAILURE;
+#else
+            return runClient(argv[i + 1]) > 0 ? EXIT_FAILURE : 0;
+#endif
+        } else if (strcmp(argv[i], "--import") == 0 && i + 1 < argc) {
+            importFile = argv[++i];
+        } else if (strcmp(argv[i], "--bill") == 0 && i + 1 < argc) {
+            billDate = argv[++i];
+        } else if (strcmp(argv[i], "--report") == 0 && i + 1 < argc) {
+            reportPeriod = argv[++i];
+        } else if (strcmp(argv[i], "--tariff") == 0 && i + 1 < argc) {
+            loadTariff(argv[++i]);
+        } else if (strcmp(argv[i], "--data") == 0 && i + 1 < argc) {
+            filename = argv[++i];
+        } else if (strcmp(argv[i], "--fast") == 0) {
+            fastMode = 1;
+        } else if (strcmp(argv[i], "--tables") == 0 && i + 1 < argc) {
+            configureTables(argv[++i]);
+        } else if (strcmp(argv[i], "--timeslots") == 0 && i + 1 < argc) {
+            configureTimeSlots(argv[++i]);
+        } else if (strcmp(argv[i], "--today") == 0 && i + 1 < argc) {
+            today = argv[++i];
+        } else {
+            printf("usage: %s [--fast] [--today <DD/MM/YYYY>] [--tables <name,...>] [--timeslots <hour,...>] [--data <file>] [--batch <script|->] [--import <csv|->] [--bill <DD/MM/YYYY|today>] [--report <DD/MM/YYYY[,DD/MM/YYYY]|all>] [--tariff <file>] [--serve <socket> [--threads <n>]] [--connect <socket>] [--convert <source> <destination>]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (today != NULL) {
+        if (parseDate(today) == NO_DATE) {
+            printf("error: invalid date %s\n", today);
+            exit(EXIT_FAILURE);
+        }
+        setCurrentDay(parseDate(today));
+    }
+    buildRates();
+    int billDay = NO_DATE;
+    if (billDate != NULL) {
+        billDay = strcmp(billDate, "today") == 0 ? currentDay() : parseDate(billDate);
+        if (billDay == NO_DATE) {
+            printf("error: invalid date %s\n", billDate);
+            exit(EXIT_FAILURE);
+        }
+    }
+    // A report covers one night, the nights from one date to another, or all
+    int reportFirst = INT_MIN, reportEnd = INT_MAX;
+    if (reportPeriod != NULL && strcmp(reportPeriod, "all") != 0) {
+        char period[32];
+        snprintf(period, sizeof(period), "%s", reportPeriod);
+        StringView dates[2];
+        int nDates = splitFields(period, dates, 2);
+        reportFirst = viewToDay(dates[0]);
+        reportEnd = nDates == 2 ? viewToDay(dates[1]) : reportFirst;
+        if (reportFirst == NO_DATE || reportEnd == NO_DATE || reportEnd < reportFirst) {
+            printf("error: invalid report period %s\n", reportPeriod);
+            exit(EXIT_FAILURE);
+        }
+        reportEnd++;
+    }
+    // Loading checks rooms against the tariff and dates legacy bookings from
+    // today, so conversion waits until both are set, whatever the order of
+    // the arguments
+    if (convertSource != NULL) {
+        convertBookingData(convertSource, convertDestination);
+        return 0;
+    }
+    // The booking data is loaded and indexed once, then kept current in memory
+    BookingStore store;
+    initBookingStore(&store);
+    if (reportPeriod != NULL) {
+        loadBookingSnapshot(filename, &store);
+        runReport(&store, reportFirst, reportEnd);
+        freeBookingStore(&store);
+        return 0;
+    }
+    loadBookingData(filename, &store);
+    if (importFile != NULL) {
+        int nRejected = importBookings(&store, importFile);
+        freeBookingStore(&store);
+        return nRejected > 0 ? EXIT_FAILURE : 0;
+    }
+    if (billDay != NO_DATE) {
+        billDepartures(&store, billDay);
+        freeBookingStore(&store);
+        return 0;
+    }
+    if (serverPath != NULL) {
+#ifdef _WIN32
+        printf("error: the booking server needs Unix sockets\n");
+        exit(EXIT_FAILURE);
+#else
+        runServer(&store, serverPath, nThreads);
+#endif
+    }
+    if (batchFile != NULL) {
+        runBatch(&store, batchFile);
+        freeBookingStore(&store);
+        return 0;
+    }
     int finished = 0;
     while (!finished) {
-        char option[32];
+        // Pick up changes made from other desks if the bookings are free, so
+        // the next action starts from current data and seldom has to be
+        // retried. Only a change waits for the lock
+        if (lockBookingDataWithin(&store, 1) != LOCK_BUSY) unlockBookingData(&store);
+        refreshOccupancy(&store);
         printf("\nWelcome to the Kashyyyk Hotel\n");
         for (int i = 0; i < 29; ++i) print(5, "-");
         print(500, "\nChoose an action (checkin, checkout, booktable, quit): ");
-        scanf("%s", &option);
-
-        if (strcmp((const char*)option, "checkin") == 0) {
-            checkIn();
-        } else if (strcmp((const char*)option, "checkout") == 0) {
-            checkOut();
-        } else if (strcmp((const char*)option, "booktable") == 0) {
-            bookTable();
-        } else if (strcmp((const char*)option, "quit") == 0) {
+        // Nothing kept by the previous action is needed any more
+        freeArena(&deskStrings);
+        char* option = trim(inputString());
+
+        if (strcmp(option, "checkin") == 0) {
+            checkIn(&store);
+        } else if (strcmp(option, "checkout") == 0) {
+            checkOut(&store);
+        } else if (strcmp(option, "booktable") == 0) {
+            bookTable(&store);
+        } else if (strcmp(option, "quit") == 0) {
             finished = 1;
         } else {
             print(500, "Action '%s' not recognised\n", option);
         }
     }
+    freeArena(&deskStrings);
+    freeBookingStore(&store);
     return 0;
 }
\ No newline at end of file